@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+
+#include <cstddef>
+
+// Fixed capacity single-producer/single-consumer ring buffer. Works on one thread, or with one thread pushing
+// and another popping. Nothing allocates after construction.
+template <typename T, size_t Capacity>
+class Channel {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+  public:
+    bool TryPush(const T& value) {
+        return TryPush(&value, 1);
+    }
+
+    bool TryPop(T& value) {
+        return TryPop(&value, 1);
+    }
+
+    // Pushes all n values or none of them
+    bool TryPush(const T* values, size_t n) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail + n - cachedHead_ > Capacity) {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+            if (tail + n - cachedHead_ > Capacity) {
+                return false;
+            }
+        }
+        for (size_t i = 0; i < n; i++) {
+            buffer_[(tail + i) & kMask] = values[i];
+        }
+        tail_.store(tail + n, std::memory_order_release);
+        return true;
+    }
+
+    // Pops exactly n values or none of them
+    bool TryPop(T* values, size_t n) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (cachedTail_ - head < n) {
+            cachedTail_ = tail_.load(std::memory_order_acquire);
+            if (cachedTail_ - head < n) {
+                return false;
+            }
+        }
+        for (size_t i = 0; i < n; i++) {
+            values[i] = buffer_[(head + i) & kMask];
+        }
+        head_.store(head + n, std::memory_order_release);
+        return true;
+    }
+
+    // Exact when called from the producer or consumer thread, a snapshot otherwise
+    size_t Size() const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+    bool Empty() const {
+        return Size() == 0;
+    }
+
+    // Called by the producer once it will never push again
+    void Close() {
+        closed_.store(true, std::memory_order_release);
+    }
+
+    bool Closed() const {
+        return closed_.load(std::memory_order_acquire);
+    }
+
+    // Called by the consumer once it will never pop again, so a producer waiting for room can give up
+    void Abandon() {
+        abandoned_.store(true, std::memory_order_release);
+    }
+
+    bool Abandoned() const {
+        return abandoned_.load(std::memory_order_acquire);
+    }
+
+  private:
+    static constexpr size_t kMask = Capacity - 1;
+
+    // head_ is only written by the consumer and tail_ by the producer. Each side keeps a cached copy of the
+    // other's index so it only touches the other side's cache line when the buffer looks full or empty.
+    alignas(64) std::atomic<size_t> head_ = 0;
+    size_t cachedTail_ = 0;
+    alignas(64) std::atomic<size_t> tail_ = 0;
+    size_t cachedHead_ = 0;
+    std::atomic<bool> closed_ = false;
+    std::atomic<bool> abandoned_ = false;
+    alignas(64) std::array<T, Capacity> buffer_;
+};
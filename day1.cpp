@@ -1,6 +1,6 @@
 
 #include "clue.h"
-#include <fstream>
+#include "input.h"
 #include <iostream>
 
 int RocketFuel(int mass) { 
@@ -30,14 +30,14 @@ int main(int argc, char** argv) {
     if (args->test != 0) {
         std::cout << (args->part2 ? RocketFuel2(args->test) : RocketFuel(args->test)) << "\n";
     } else if (!args->file.empty()) {
-        std::ifstream file(args->file);
-        int input = 0;
+        std::optional<std::vector<int>> masses = ReadIntegers<int>(args->file);
+        if (!masses) {
+            return 1;
+        }
         int totalFuel = 0;
-        file >> input;
-        do {
-            totalFuel += args->part2 ? RocketFuel2(input) : RocketFuel(input);
-            file >> input;
-        } while(file.good());
+        for (int mass : *masses) {
+            totalFuel += args->part2 ? RocketFuel2(mass) : RocketFuel(mass);
+        }
         std::cout << totalFuel << "\n";
     }
 }
@@ -1,5 +1,9 @@
 
 #include "clue.h"
+#include "intcode.h"
+#include "intcode_image.h"
+#include "intcode_jit.h"
+#include "intcode_trace.h"
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -7,145 +11,6 @@
 #include <algorithm>
 #include <unordered_map>
 
-constexpr int64_t ADD           = 1;
-constexpr int64_t MULT          = 2;
-constexpr int64_t INPUT         = 3;
-constexpr int64_t OUTPUT        = 4;
-constexpr int64_t JUMP_IF_TRUE  = 5;
-constexpr int64_t JUMP_IF_FALSE = 6;
-constexpr int64_t LESS_THAN     = 7;
-constexpr int64_t EQUALS        = 8;
-constexpr int64_t RELATIVE_ADJ  = 9;
-constexpr int64_t HALT          = 99;
-
-constexpr int64_t POSITION_MODE  = 0;
-constexpr int64_t IMMEDIATE_MODE = 1;
-constexpr int64_t RELATIVE_MODE  = 2;
-
-enum Interrupt {
-    kInput,
-    kHalt
-};
-
-struct Intcode {
-    std::vector<int64_t> memory;
-    int64_t pc = 0;
-    int64_t relativeBase = 0;
-};
-
-int64_t DecodeOpcode(Intcode& intcode, int64_t* parameters[4]) {
-    int64_t opcode = intcode.memory[intcode.pc];
-    int64_t op = opcode % 100;
-    int64_t n = 0;
-    switch (op) {
-        case ADD:
-        case MULT:
-        case LESS_THAN:
-        case EQUALS:
-            n = 3;
-            break;
-        case JUMP_IF_TRUE:
-        case JUMP_IF_FALSE:
-            n = 2;
-            break;
-        case INPUT:
-        case OUTPUT:
-        case RELATIVE_ADJ:
-            n = 1;
-            break;
-        default:
-            break;
-    }
-    opcode /= 100;
-    for (int64_t i = 0; i < n; i++) {
-        int64_t paramMode = opcode % 10;
-        switch (paramMode) {
-            case POSITION_MODE: 
-                parameters[i] = &(intcode.memory[intcode.memory[intcode.pc+i+1]]);
-                break;
-            case IMMEDIATE_MODE: 
-                parameters[i] = &(intcode.memory[intcode.pc+i+1]);
-                break;
-            case RELATIVE_MODE:
-                parameters[i] = &(intcode.memory[intcode.relativeBase + intcode.memory[intcode.pc+i+1]]);
-                break;
-        }
-        opcode /= 10;
-    }
-    return op;
-}
-
-Interrupt RunProgram(Intcode& intcode, std::deque<int64_t>* inputs = nullptr, std::deque<int64_t>* outputs = nullptr) {
-    int64_t* params[4];
-
-    while (true) {
-        int64_t op = DecodeOpcode(intcode, params);
-        switch(op) {
-            case ADD:
-                *params[2] = *params[0] + *params[1];
-                intcode.pc += 4;
-                break;
-            case MULT:
-                *params[2] = *params[0] * *params[1];
-                intcode.pc += 4;
-                break;
-            case INPUT:
-                if (inputs) {
-                    if (inputs->empty()) {
-                        return kInput;
-                    }
-                    *params[0] = inputs->front();
-                    inputs->pop_front();
-                } else {
-                    std::cout << "Enter an Integer: ";
-                    std::cin >> (*params[0]);
-                }
-                intcode.pc += 2;
-                break;
-            case OUTPUT: 
-                if (outputs) {
-                    outputs->push_back(*params[0]);
-                } else {
-                    std::cout << *params[0] << "\n";
-                }
-                intcode.pc += 2;
-                break;
-            case JUMP_IF_TRUE:
-                intcode.pc = (*params[0]) ? *params[1] : intcode.pc + 3;
-                break;
-            case JUMP_IF_FALSE: 
-                intcode.pc = (!*params[0]) ? *params[1] : intcode.pc + 3;
-                break;
-            case LESS_THAN:
-                *params[2] = (*params[0] < *params[1]);
-                intcode.pc += 4;
-                break;
-            case EQUALS:
-                *params[2] = (*params[0] == *params[1]);
-                intcode.pc += 4;
-                break;
-            case RELATIVE_ADJ:
-                intcode.relativeBase += *params[0]; 
-                intcode.pc += 2;
-                break;
-            case HALT:
-                return kHalt;
-        }
-    }
-}
-
-std::vector<int64_t> ReadProgram(std::istream& istream) {
-    char comma;
-    int64_t opcode;
-    std::vector<int64_t> program;
-    while (istream.good()) {
-        istream >> opcode;
-        istream >> comma;
-        program.push_back(opcode);
-    }
-    return program;
-}
-
 struct Point {
     int x, y;
 };
@@ -161,10 +26,10 @@ struct PointHash {
 };
 
 struct PainterBot3000 {
-    Intcode intcode;
+    Intcode<int64_t> intcode;
     char dir = '^'; 
-    std::deque<int64_t> inputs;
-    std::deque<int64_t> outputs;
+    Channel<int64_t, 16> inputs;
+    Channel<int64_t, 16> outputs;
     Point pos = {0, 0};
 };
 
@@ -172,45 +37,86 @@ struct Args {
     std::string file = "day11.txt";
     std::string test = "";
     bool part2 = false;
+    std::string profile = ""; // Write an execution profile here. Needs a -DINTCODE_PROFILE=1 build
+    bool jit = false; // Compile hot code to x86-64
+    std::string record = ""; // Write a trace of the program and its I/O here, for intcode_replay
 };
 
 int main(int argc, char** argv) {
     clue::CommandLine<Args> cl;
     cl.Optional(&Args::test, "test");
     cl.Optional(&Args::part2, "part2");
+    cl.Optional(&Args::profile, "profile");
+    cl.Optional(&Args::jit, "jit");
+    cl.Optional(&Args::record, "record");
     cl.Positional(&Args::file, "file");
     auto args = cl.ParseArgs(argc, argv);
+#if !INTCODE_PROFILE
+    if (!args->profile.empty()) {
+        std::cerr << "-profile needs a profiler build, rebuild with -DINTCODE_PROFILE=1\n";
+        return 1;
+    }
+#endif
+#if !INTCODE_JIT
+    if (args->jit) {
+        std::cerr << "-jit needs x86-64 Linux or macOS\n";
+        return 1;
+    }
+#endif
 
     PainterBot3000 painterBot;
 
     if (!args->test.empty()) {
         std::istringstream in(args->test);
-        painterBot.intcode.memory = ReadProgram(in);
+        painterBot.intcode.memory = ReadProgram<int64_t>(in);
     } else if (!args->file.empty()) {
-        std::ifstream file(args->file);
-        painterBot.intcode.memory = ReadProgram(file);
+        std::optional<Memory<int64_t>> memory = OpenProgram<int64_t>(args->file);
+        if (!memory) {
+            return 1;
+        }
+        painterBot.intcode.memory = std::move(*memory);
     }
-    painterBot.intcode.memory.resize(painterBot.intcode.memory.size() * 10, 0);
     
+    Trace<int64_t> trace;
+    Trace<int64_t>* recording = args->record.empty() ? nullptr : &trace;
+    if (recording) {
+        trace.image = painterBot.intcode.memory.Image();
+    }
+
     int startingColor = args->part2 ? 1 : 0;
     std::unordered_map<Point, int, PointHash> hull;
     hull[{0, 0}] = startingColor;
-    painterBot.inputs.push_back(startingColor);
+    painterBot.inputs.TryPush(startingColor);
 
     Point min = {1000, 1000};
     Point max = {-1000, -1000};
 
+#if INTCODE_JIT
+    Jit jit;
+#endif
+    auto run = [&](auto input, auto output) {
+#if INTCODE_JIT
+        if (args->jit) {
+            return RunJit(painterBot.intcode, jit, input, output);
+        }
+#endif
+        return RunProgram(painterBot.intcode, input, output);
+    };
+
     while (true) {
-        const Interrupt interrupt = RunProgram(painterBot.intcode, &painterBot.inputs, &painterBot.outputs);
-        if (interrupt == kInput) {
-            int color = painterBot.outputs.front();
-            painterBot.outputs.pop_front();
+        const Interrupt interrupt = run(RecordInputs(&painterBot.inputs, recording), RecordOutputs(&painterBot.outputs, recording));
+        if (interrupt == kHalt) {
+            break;
+        }
+        // The bot outputs a color and a turn for every panel it visits
+        int64_t step[2];
+        while (painterBot.outputs.TryPop(step, 2)) {
+            int color = static_cast<int>(step[0]);
         
             hull[painterBot.pos] = color;
 
             // turn 0 == left. turn 1 == right
-            int turn = painterBot.outputs.front();
-            painterBot.outputs.pop_front();
+            int turn = static_cast<int>(step[1]);
 
             switch (painterBot.dir) {
                 case '^':
@@ -254,10 +160,9 @@ int main(int argc, char** argv) {
             min.y = std::min(min.y, painterBot.pos.y);
             max.x = std::max(max.x, painterBot.pos.x);
             max.y = std::max(max.y, painterBot.pos.y);
-
-            painterBot.inputs.push_back(hull[painterBot.pos]);
-        } else if (interrupt == kHalt) {
-            break;
+        }
+        if (interrupt == kInput) {
+            painterBot.inputs.TryPush(hull[painterBot.pos]);
         }
     }
     std::cout << hull.size() << "\n";
@@ -268,5 +173,12 @@ int main(int argc, char** argv) {
         }
         printf("\n");
     }
+
+    if (recording && !WriteTrace(args->record, trace)) {
+        return 1;
+    }
+    if (!args->profile.empty() && !WriteProfile(args->profile)) {
+        return 1;
+    }
 }
 
@@ -1,204 +1,122 @@
 
 #include "clue.h"
+#include "intcode.h"
+#include "intcode_checkpoint.h"
+#include "intcode_image.h"
+#include "intcode_jit.h"
+#include "intcode_trace.h"
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <sstream>
+#include <string>
 #include <thread>
 
-constexpr int64_t ADD           = 1;
-constexpr int64_t MULT          = 2;
-constexpr int64_t INPUT         = 3;
-constexpr int64_t OUTPUT        = 4;
-constexpr int64_t JUMP_IF_TRUE  = 5;
-constexpr int64_t JUMP_IF_FALSE = 6;
-constexpr int64_t LESS_THAN     = 7;
-constexpr int64_t EQUALS        = 8;
-constexpr int64_t RELATIVE_ADJ  = 9;
-constexpr int64_t HALT          = 99;
-
-constexpr int64_t POSITION_MODE  = 0;
-constexpr int64_t IMMEDIATE_MODE = 1;
-constexpr int64_t RELATIVE_MODE  = 2;
-
-enum Interrupt {
-    kInput,
-    kHalt
-};
-
-struct Intcode {
-    std::vector<int64_t> memory;
-    int64_t pc = 0;
-    int64_t relativeBase = 0;
-};
+constexpr char kTiles[] = {' ', '|', '#', '_', 'o'};
 
-int64_t DecodeOpcode(Intcode& intcode, int64_t* parameters[4]) {
-    int64_t opcode = intcode.memory[intcode.pc];
-    int64_t op = opcode % 100;
-    int64_t n = 0;
-    switch (op) {
-        case ADD:
-        case MULT:
-        case LESS_THAN:
-        case EQUALS:
-            n = 3;
-            break;
-        case JUMP_IF_TRUE:
-        case JUMP_IF_FALSE:
-            n = 2;
-            break;
-        case INPUT:
-        case OUTPUT:
-        case RELATIVE_ADJ:
-            n = 1;
-            break;
-        default:
-            break;
-    }
-    opcode /= 100;
-    for (int64_t i = 0; i < n; i++) {
-        int64_t paramMode = opcode % 10;
-        switch (paramMode) {
-            case POSITION_MODE: 
-                parameters[i] = &(intcode.memory[intcode.memory[intcode.pc+i+1]]);
-                break;
-            case IMMEDIATE_MODE: 
-                parameters[i] = &(intcode.memory[intcode.pc+i+1]);
-                break;
-            case RELATIVE_MODE:
-                parameters[i] = &(intcode.memory[intcode.relativeBase + intcode.memory[intcode.pc+i+1]]);
-                break;
+void DrawScreen(int screen[256][256], int score, int maxX, int maxY) {
+    std::string frame = "SCORE: " + std::to_string(score) + "\n";
+    for (int y = 0; y <= maxY; y++) {
+        for (int x = 0; x <= maxX; x++) {
+            frame += kTiles[screen[y][x]];
         }
-        opcode /= 10;
+        frame += '\n';
     }
-    return op;
+    fwrite(frame.data(), 1, frame.size(), stdout);
 }
 
-Interrupt RunProgram(Intcode& intcode, std::deque<int64_t>* inputs = nullptr, std::deque<int64_t>* outputs = nullptr) {
-    int64_t* params[4];
+// The screen as the terminal last showed it. After the first frame only the cells that changed are sent, by
+// moving the cursor up from the line below the picture and back again
+struct Display {
+    int shown[256][256];
+    int shownScore = 0;
+    int shownMaxX = -1;
+    int shownMaxY = -1;
 
-    while (true) {
-        int64_t op = DecodeOpcode(intcode, params);
-        switch(op) {
-            case ADD:
-                *params[2] = *params[0] + *params[1];
-                intcode.pc += 4;
-                break;
-            case MULT:
-                *params[2] = *params[0] * *params[1];
-                intcode.pc += 4;
-                break;
-            case INPUT:
-                if (inputs) {
-                    if (inputs->empty()) {
-                        return kInput;
+    void Draw(int screen[256][256], int score, int maxX, int maxY) {
+        if (maxX != shownMaxX || maxY != shownMaxY) {
+            DrawScreen(screen, score, maxX, maxY);
+        } else {
+            std::string frame;
+            char move[64];
+            auto put = [&](int row, int column, const std::string& text) {
+                const int up = maxY + 2 - row;
+                snprintf(move, sizeof(move), "\x1b[%dA\x1b[%dG", up, column + 1);
+                frame += move;
+                frame += text;
+                snprintf(move, sizeof(move), "\x1b[%dB\r", up);
+                frame += move;
+            };
+            if (score != shownScore) {
+                put(0, 0, "SCORE: " + std::to_string(score) + "\x1b[K");
+            }
+            for (int y = 0; y <= maxY; y++) {
+                for (int x = 0; x <= maxX; x++) {
+                    if (screen[y][x] != shown[y][x]) {
+                        put(y + 1, x, std::string(1, kTiles[screen[y][x]]));
                     }
-                    *params[0] = inputs->front();
-                    inputs->pop_front();
-                } else {
-                    std::cout << "Enter an Integer: ";
-                    std::cin >> (*params[0]);
-                }
-                intcode.pc += 2;
-                break;
-            case OUTPUT: 
-                if (outputs) {
-                    outputs->push_back(*params[0]);
-                } else {
-                    std::cout << *params[0] << "\n";
                 }
-                intcode.pc += 2;
-                break;
-            case JUMP_IF_TRUE:
-                intcode.pc = (*params[0]) ? *params[1] : intcode.pc + 3;
-                break;
-            case JUMP_IF_FALSE: 
-                intcode.pc = (!*params[0]) ? *params[1] : intcode.pc + 3;
-                break;
-            case LESS_THAN:
-                *params[2] = (*params[0] < *params[1]);
-                intcode.pc += 4;
-                break;
-            case EQUALS:
-                *params[2] = (*params[0] == *params[1]);
-                intcode.pc += 4;
-                break;
-            case RELATIVE_ADJ:
-                intcode.relativeBase += *params[0]; 
-                intcode.pc += 2;
-                break;
-            case HALT:
-                return kHalt;
-        }
-    }
-}
-
-std::vector<int64_t> ReadProgram(std::istream& istream) {
-    char comma;
-    int64_t opcode;
-    std::vector<int64_t> program;
-    while (istream.good()) {
-        istream >> opcode;
-        istream >> comma;
-        program.push_back(opcode);
-    }
-    return program;
-}
-
-void DrawScreen(int screen[256][256], int score, int maxX, int maxY) {
-    printf("SCORE: %d\n", score);
-    for (int y = 0; y <= maxY; y++) {
-        for (int x = 0; x <= maxX; x++) {
-            switch (screen[y][x]) {
-                case 0:
-                    printf(" ");
-                    break;
-                case 1:
-                    printf("|");
-                    break;
-                case 2:
-                    printf("#");
-                    break;
-                case 3:
-                    printf("_");
-                    break;
-                case 4:
-                    printf("o");
-                    break;
             }
+            fwrite(frame.data(), 1, frame.size(), stdout);
         }
-        printf("\n");
+        fflush(stdout);
+        std::copy(&screen[0][0], &screen[0][0] + 256 * 256, &shown[0][0]);
+        shownScore = score;
+        shownMaxX = maxX;
+        shownMaxY = maxY;
     }
-}
+};
 
 struct Args {
     std::string file = "day13.txt";
     std::string test = "";
     bool part2 = false;
+    std::string profile = ""; // Write an execution profile here. Needs a -DINTCODE_PROFILE=1 build
+    bool jit = false; // Compile hot code to x86-64
+    std::string record = ""; // Write a trace of the program and its I/O here, for intcode_replay
+    bool headless = false; // Skip the screen and print the score and blocks left once the game is over
+    int fps = 60; // Frames a second to play at. Frames the terminal can't keep up with are skipped. 0 for no limit
+    std::string checkpoint = ""; // Save the game here every checkpointFrames frames
+    int checkpointFrames = 1000;
+    std::string resume = ""; // Carry on from a checkpoint instead of starting the program
 };
 
 int main(int argc, char** argv) {
     clue::CommandLine<Args> cl;
     cl.Optional(&Args::test, "test");
     cl.Optional(&Args::part2, "part2");
+    cl.Optional(&Args::profile, "profile");
+    cl.Optional(&Args::jit, "jit");
+    cl.Optional(&Args::record, "record");
+    cl.Optional(&Args::headless, "headless");
+    cl.Optional(&Args::fps, "fps");
+    cl.Optional(&Args::checkpoint, "checkpoint");
+    cl.Optional(&Args::checkpointFrames, "checkpointFrames");
+    cl.Optional(&Args::resume, "resume");
     cl.Positional(&Args::file, "file");
     auto args = cl.ParseArgs(argc, argv);
-
-    Intcode intcode;
-
-    if (!args->test.empty()) {
-        std::istringstream in(args->test);
-        intcode.memory = ReadProgram(in);
-    } else if (!args->file.empty()) {
-        std::ifstream file(args->file);
-        intcode.memory = ReadProgram(file);
+#if !INTCODE_PROFILE
+    if (!args->profile.empty()) {
+        std::cerr << "-profile needs a profiler build, rebuild with -DINTCODE_PROFILE=1\n";
+        return 1;
+    }
+#endif
+#if !INTCODE_JIT
+    if (args->jit) {
+        std::cerr << "-jit needs x86-64 Linux or macOS\n";
+        return 1;
+    }
+#endif
+    if (!args->record.empty() && !args->resume.empty()) {
+        std::cerr << "-record needs the game from the start, not a -resume\n";
+        return 1;
     }
-    intcode.memory.resize(intcode.memory.size() * 10, 0);
-    if (args->part2) {
-        intcode.memory[0] = 2;
-    } 
 
-    std::deque<int64_t> inputs;
-    std::deque<int64_t> outputs;
+    Intcode<int64_t> intcode;
+    Channel<int64_t, 16> inputs;
+    Channel<int64_t, 1024> outputs;
     int screen[256][256] = {0};
     int maxX = 0;
     int maxY = 0;
@@ -207,12 +125,91 @@ int main(int argc, char** argv) {
     int ballX = 0;
     int paddleX = 0;
 
+    // Besides the VM and its queues a checkpoint keeps score, ballX, paddleX, maxX and maxY, then an x, y and tile
+    // for every cell of the screen that isn't empty
+    auto saveCheckpoint = [&]() {
+        Checkpoint<int64_t> checkpoint = {intcode, Pending(&inputs), Pending(&outputs), {score, ballX, paddleX, maxX, maxY}};
+        for (int y = 0; y <= maxY; y++) {
+            for (int x = 0; x <= maxX; x++) {
+                if (screen[y][x] != 0) {
+                    checkpoint.driver.insert(checkpoint.driver.end(), {x, y, screen[y][x]});
+                }
+            }
+        }
+        return WriteCheckpoint(args->checkpoint, checkpoint);
+    };
+
+    if (!args->resume.empty()) {
+        std::optional<Checkpoint<int64_t>> checkpoint = ReadCheckpoint<int64_t>(args->resume);
+        if (!checkpoint) {
+            return 1;
+        }
+        const std::vector<int64_t>& driver = checkpoint->driver;
+        auto onScreen = [](int64_t v) { return v >= 0 && v < 256; };
+        bool valid = driver.size() >= 5 && (driver.size() - 5) % 3 == 0 && onScreen(driver[3]) && onScreen(driver[4]) &&
+            inputs.TryPush(checkpoint->inputs.data(), checkpoint->inputs.size()) &&
+            outputs.TryPush(checkpoint->outputs.data(), checkpoint->outputs.size());
+        for (size_t i = 5; valid && i < driver.size(); i += 3) {
+            valid = onScreen(driver[i]) && onScreen(driver[i + 1]);
+            if (valid) {
+                screen[driver[i + 1]][driver[i]] = static_cast<int>(driver[i + 2]);
+            }
+        }
+        if (!valid) {
+            std::cerr << args->resume << " is not a day 13 checkpoint\n";
+            return 1;
+        }
+        score = static_cast<int>(driver[0]);
+        ballX = static_cast<int>(driver[1]);
+        paddleX = static_cast<int>(driver[2]);
+        maxX = static_cast<int>(driver[3]);
+        maxY = static_cast<int>(driver[4]);
+        intcode = std::move(checkpoint->intcode);
+    } else if (!args->test.empty()) {
+        std::istringstream in(args->test);
+        intcode.memory = ReadProgram<int64_t>(in);
+    } else if (!args->file.empty()) {
+        std::optional<Memory<int64_t>> memory = OpenProgram<int64_t>(args->file);
+        if (!memory) {
+            return 1;
+        }
+        intcode.memory = std::move(*memory);
+    }
+    if (args->part2 && args->resume.empty()) {
+        intcode.memory[0] = 2;
+    } 
+
+    Trace<int64_t> trace;
+    Trace<int64_t>* recording = args->record.empty() ? nullptr : &trace;
+    if (recording) {
+        trace.image = intcode.memory.Image();
+    }
+
+    using Clock = std::chrono::steady_clock;
+    const Clock::duration frameTime = args->fps > 0 ? Clock::duration(std::chrono::seconds(1)) / args->fps : Clock::duration::zero();
+    Clock::time_point nextFrame = Clock::now();
+    auto display = std::make_unique<Display>();
+    int frames = 0;
+
+#if INTCODE_JIT
+    Jit jit;
+#endif
+    auto run = [&](auto input, auto output) {
+#if INTCODE_JIT
+        if (args->jit) {
+            return RunJit(intcode, jit, input, output);
+        }
+#endif
+        return RunProgram(intcode, input, output);
+    };
+
     while (true) {
-        Interrupt interrupt = RunProgram(intcode, &inputs, &outputs);
-        while (!outputs.empty()) {
-            int x = outputs.front(); outputs.pop_front();
-            int y = outputs.front(); outputs.pop_front();
-            int tileId = outputs.front(); outputs.pop_front();
+        Interrupt interrupt = run(RecordInputs(&inputs, recording), RecordOutputs(&outputs, recording));
+        int64_t draw[3];
+        while (outputs.TryPop(draw, 3)) {
+            int x = static_cast<int>(draw[0]);
+            int y = static_cast<int>(draw[1]);
+            int tileId = static_cast<int>(draw[2]);
             if (x == -1 && y == 0) {
                 score = tileId;
             } else {
@@ -230,13 +227,40 @@ int main(int argc, char** argv) {
             maxX = std::max(maxX, x);
             maxY = std::max(maxY, y);
         }
-        DrawScreen(screen, score, maxX, maxY);
+        // A full output channel only means there is more to draw before the game wants input
+        if (interrupt == kOutput) continue;
         if (interrupt == kHalt) break;
-        if (paddleX > ballX) inputs.push_back(-1);
-        if (paddleX < ballX) inputs.push_back(1);
-        if (paddleX == ballX) inputs.push_back(0);
-        using namespace std::chrono_literals;
-        std::this_thread::sleep_for(16ms);
+        if (!args->headless) {
+            // Only draw if this frame is due. Once more than a frame behind, skip drawing until caught up
+            if (frameTime == Clock::duration::zero() || Clock::now() < nextFrame + frameTime) {
+                display->Draw(screen, score, maxX, maxY);
+            }
+            nextFrame += frameTime;
+            std::this_thread::sleep_until(nextFrame);
+        }
+        if (paddleX > ballX) inputs.TryPush(-1);
+        if (paddleX < ballX) inputs.TryPush(1);
+        if (paddleX == ballX) inputs.TryPush(0);
+        if (!args->checkpoint.empty() && ++frames % std::max(args->checkpointFrames, 1) == 0 && !saveCheckpoint()) {
+            return 1;
+        }
+    }
+
+    if (args->headless) {
+        int blocks = 0;
+        for (int y = 0; y <= maxY; y++) {
+            blocks += static_cast<int>(std::count(screen[y], screen[y] + maxX + 1, 2));
+        }
+        printf("SCORE: %d\nBLOCKS: %d\n", score, blocks);
+    } else {
+        display->Draw(screen, score, maxX, maxY);
+    }
+
+    if (recording && !WriteTrace(args->record, trace)) {
+        return 1;
+    }
+    if (!args->profile.empty() && !WriteProfile(args->profile)) {
+        return 1;
     }
 }
 
@@ -1,89 +1,281 @@
 
 #include "clue.h"
+#include "intcode.h"
+#include "intcode_image.h"
+#include "intcode_batch.h"
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <atomic>
+#include <map>
+#include <optional>
+#include <thread>
 
-void RunProgram(std::vector<int>& memory) {
-    int pc = 0;
-    int opcode = memory[pc];
+// A polynomial in the noun and verb. Maps (noun power, verb power) to its coefficient, zero terms are dropped
+using Polynomial = std::map<std::pair<int, int>, int64_t>;
+
+Polynomial Add(const Polynomial& a, const Polynomial& b) {
+    Polynomial sum = a;
+    for (const auto& [powers, coefficient] : b) {
+        if ((sum[powers] += coefficient) == 0) {
+            sum.erase(powers);
+        }
+    }
+    return sum;
+}
+
+Polynomial Multiply(const Polynomial& a, const Polynomial& b) {
+    Polynomial product;
+    for (const auto& [aPowers, aCoefficient] : a) {
+        for (const auto& [bPowers, bCoefficient] : b) {
+            std::pair<int, int> powers = {aPowers.first + bPowers.first, aPowers.second + bPowers.second};
+            if ((product[powers] += aCoefficient * bCoefficient) == 0) {
+                product.erase(powers);
+            }
+        }
+    }
+    return product;
+}
+
+std::optional<int64_t> AsConstant(const Polynomial& p) {
+    if (p.empty()) {
+        return 0;
+    } else if (p.size() == 1 && p.begin()->first == std::make_pair(0, 0)) {
+        return p.begin()->second;
+    }
+    return {};
+}
+
+// Runs a day 2 program with the noun and verb left as unknowns and returns memory[0] as a polynomial in them.
+// Cells whose value depends on an address computed from the noun or verb become unknown, which is fine as long
+// as nothing reads them before they are overwritten. Gives up on unknown addresses, symbolic opcodes and
+// anything other than ADD, MULT and HALT.
+std::optional<Polynomial> EvaluateSymbolically(const Intcode<int>& intcode) {
+    std::vector<std::optional<Polynomial>> memory;
+    for (int cell : intcode.memory.Image()) {
+        memory.push_back(Polynomial{{{0, 0}, cell}});
+    }
+    if (memory.size() < 3) {
+        return {};
+    }
+    memory[1] = Polynomial{{{1, 0}, 1}};
+    memory[2] = Polynomial{{{0, 1}, 1}};
+
+    auto constantAt = [&](int64_t address) -> std::optional<int64_t> {
+        if (address < 0 || address >= static_cast<int64_t>(memory.size()) || !memory[address]) {
+            return {};
+        }
+        return AsConstant(*memory[address]);
+    };
+    // The value an operand refers to, unknown if its address isn't a known cell of the image
+    auto operand = [&](int64_t pc, int i, int64_t modes) -> std::optional<Polynomial> {
+        const std::optional<Polynomial>& raw = memory[pc + i + 1];
+        if (modes % 10 == IMMEDIATE_MODE) {
+            return raw;
+        }
+        std::optional<int64_t> address = raw ? AsConstant(*raw) : std::nullopt;
+        if (!address || *address < 0 || *address >= static_cast<int64_t>(memory.size())) {
+            return {};
+        }
+        return memory[*address];
+    };
+
+    int64_t pc = 0;
     while (true) {
-        switch(opcode) {
-            case 1:
-                memory[memory[pc+3]] = memory[memory[pc+1]] + memory[memory[pc+2]];
-                break;
-            case 2:
-                memory[memory[pc+3]] = memory[memory[pc+1]] * memory[memory[pc+2]];
-                break;
-            case 99:
-                return;
+        std::optional<int64_t> opcode = constantAt(pc);
+        if (!opcode) {
+            return {};
+        }
+        int64_t op = *opcode % 100;
+        if (op == HALT) {
+            break;
+        } else if (op != ADD && op != MULT) {
+            return {};
+        }
+
+        std::optional<int64_t> dest = constantAt(pc + 3);
+        if (!dest || *dest < 0 || *dest >= static_cast<int64_t>(memory.size())) {
+            return {};
+        }
+        std::optional<Polynomial> a = operand(pc, 0, *opcode / 100);
+        std::optional<Polynomial> b = operand(pc, 1, *opcode / 1000);
+        if (a && b) {
+            memory[*dest] = (op == ADD) ? Add(*a, *b) : Multiply(*a, *b);
+        } else {
+            memory[*dest] = std::nullopt;
         }
         pc += 4;
-        opcode = memory[pc];
-   }
+    }
+    return memory[0];
 }
 
-int SearchForNounVerb(std::vector<int> memory) {
-    for (int i = 0; i < 100; i++) {
-        for (int j = 0; j < 100; j++) {
-            std::vector<int> memCopy = memory;
+// Solves p(noun, verb) == target for the first pair in search order when p is at most linear
+std::optional<int64_t> SolveLinear(const Polynomial& p, int target, int min, int max) {
+    int64_t constant = 0, nounCoefficient = 0, verbCoefficient = 0;
+    for (const auto& [powers, coefficient] : p) {
+        if (powers == std::make_pair(0, 0)) {
+            constant = coefficient;
+        } else if (powers == std::make_pair(1, 0)) {
+            nounCoefficient = coefficient;
+        } else if (powers == std::make_pair(0, 1)) {
+            verbCoefficient = coefficient;
+        } else {
+            return {};
+        }
+    }
+    for (int64_t noun = min; noun <= max; noun++) {
+        int64_t rest = target - constant - nounCoefficient * noun;
+        if (verbCoefficient == 0) {
+            if (rest == 0) {
+                return (100 * noun) + min;
+            }
+        } else if (rest % verbCoefficient == 0) {
+            int64_t verb = rest / verbCoefficient;
+            if (verb >= min && verb <= max) {
+                return (100 * noun) + verb;
+            }
+        }
+    }
+    return -1;
+}
+
+int64_t SearchForNounVerb(const Intcode<int>& intcode, int target, int min, int max) {
+    for (int i = min; i <= max; i++) {
+        for (int j = min; j <= max; j++) {
+            Intcode<int> copy = Fork(intcode);
             int noun = i;
             int verb = j;
-            memCopy[1] = noun;
-            memCopy[2] = verb;
-            RunProgram(memCopy);
-            if (memCopy[0] == 19690720) {
-                return (100 * noun) + verb;
+            copy.memory[1] = noun;
+            copy.memory[2] = verb;
+            RunProgram(copy);
+            if (copy.memory.Load(0) == target) {
+                return (100 * static_cast<int64_t>(noun)) + verb;
+            }
+        }
+    }
+    return -1;
+}
+
+// Same search order as SearchForNounVerb, but Batch<int>::kLanes pairs at a time in lockstep on one thread
+int64_t BatchSearchForNounVerb(const Intcode<int>& intcode, int target, int min, int max) {
+    constexpr size_t kLanes = Batch<int>::kLanes;
+    const int64_t span = max - min + 1;
+    const int64_t pairs = span * span;
+    for (int64_t first = 0; first < pairs; first += kLanes) {
+        const size_t count = static_cast<size_t>(std::min<int64_t>(kLanes, pairs - first));
+        Batch<int> batch(intcode, count);
+        for (size_t lane = 0; lane < count; lane++) {
+            batch.At(lane, 1) = static_cast<int>(min + (first + lane) / span);
+            batch.At(lane, 2) = static_cast<int>(min + (first + lane) % span);
+        }
+        batch.Run();
+        for (size_t lane = 0; lane < count; lane++) {
+            if (batch.Load(lane, 0) == target) {
+                return (100 * static_cast<int64_t>(batch.Load(lane, 1))) + batch.Load(lane, 2);
             }
         }
     }
     return -1;
 }
 
-std::vector<int> ReadProgram(std::istream& istream) {
-    char comma;
-    int opcode;
-    std::vector<int> program;
-    while (istream.good()) {
-        istream >> opcode;
-        istream >> comma;
-        program.push_back(opcode);
+// Spreads the search over threadCount workers. Each worker claims a noun at a time and runs every verb for it
+// in one scratch VM that is reset in place between trials. Everyone stops once any worker hits the target,
+// so with several solutions in range any one of them may be returned.
+int64_t ParallelSearchForNounVerb(const Intcode<int>& intcode, int target, int min, int max, int threadCount) {
+    std::atomic<int> nextNoun = min;
+    std::atomic<bool> found = false;
+    std::atomic<int64_t> result = -1;
+
+    auto worker = [&]() {
+        Intcode<int> scratch;
+        for (int noun = nextNoun++; noun <= max && !found; noun = nextNoun++) {
+            for (int verb = min; verb <= max && !found.load(std::memory_order_relaxed); verb++) {
+                Restore(scratch, intcode);
+                scratch.memory[1] = noun;
+                scratch.memory[2] = verb;
+                RunProgram(scratch);
+                if (scratch.memory.Load(0) == target && !found.exchange(true)) {
+                    result = (100 * static_cast<int64_t>(noun)) + verb;
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; i++) {
+        threads.emplace_back(worker);
+    }
+    for (auto& thread : threads) {
+        thread.join();
     }
-    return program;
+    return result;
 }
 
 struct Args {
     std::string file = "day2.txt";
     std::string test = "";
     bool part2 = false;
+    int target = 19690720;
+    int min = 0;
+    int max = 99;
+    int threads = 1; // 0 uses every core
+    bool bruteForce = false;
+    bool batch = false; // Brute force on one thread, several pairs at a time in lockstep
 };
 
 int main(int argc, char** argv) {
     clue::CommandLine<Args> cl;
     cl.Optional(&Args::test, "test");
     cl.Optional(&Args::part2, "part2");
+    cl.Optional(&Args::target, "target");
+    cl.Optional(&Args::min, "min");
+    cl.Optional(&Args::max, "max");
+    cl.Optional(&Args::threads, "threads");
+    cl.Optional(&Args::bruteForce, "bruteForce");
+    cl.Optional(&Args::batch, "batch");
     cl.Positional(&Args::file, "file");
     auto args = cl.ParseArgs(argc, argv);
 
     if (!args->test.empty()) {
         std::istringstream in(args->test);
-        std::vector<int> program = ReadProgram(in);
-        RunProgram(program);
-        for (int i : program) {
+        Intcode<int> intcode;
+        intcode.memory = ReadProgram<int>(in);
+        RunProgram(intcode);
+        for (int i : intcode.memory.Image()) {
             std::cout << i << ",";
         }
         std::cout << "\n";
     } else if (!args->file.empty()) {
-        std::ifstream file(args->file);
-        std::vector<int> program = ReadProgram(file);
+        Intcode<int> intcode;
+        std::optional<Memory<int>> memory = OpenProgram<int>(args->file);
+        if (!memory) {
+            return 1;
+        }
+        intcode.memory = std::move(*memory);
         if (!args->part2) {
-            program[1] = 12;
-            program[2] = 2;
-            RunProgram(program);
-            std::cout << program[0] << "\n";
+            intcode.memory[1] = 12;
+            intcode.memory[2] = 2;
+            RunProgram(intcode);
+            std::cout << intcode.memory[0] << "\n";
         } else {
-            int result = SearchForNounVerb(program);
-            std::cout << result << "\n";
+            // Solve memory[0] == target directly when it comes out linear, otherwise fall back to running every pair
+            std::optional<int64_t> result;
+            if (!args->bruteForce) {
+                if (std::optional<Polynomial> p = EvaluateSymbolically(intcode)) {
+                    result = SolveLinear(*p, args->target, args->min, args->max);
+                }
+            }
+            if (!result) {
+                int threads = args->threads ? args->threads : static_cast<int>(std::thread::hardware_concurrency());
+                if (args->batch) {
+                    result = BatchSearchForNounVerb(intcode, args->target, args->min, args->max);
+                } else {
+                    result = (threads > 1)
+                        ? ParallelSearchForNounVerb(intcode, args->target, args->min, args->max, threads)
+                        : SearchForNounVerb(intcode, args->target, args->min, args->max);
+                }
+            }
+            std::cout << *result << "\n";
         }
     }
 }
@@ -1,8 +1,16 @@
 
 #include "clue.h"
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <sstream>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+#include <cstdlib>
 
 struct Point {
     int x, y;
@@ -40,115 +48,216 @@ Wire ReadOneWire(std::istream& istream) {
     return wire;
 }
 
-std::pair<Wire, Wire> ReadTwoWires(std::istream& istream) {
-    std::string line1, line2;
-    std::getline(istream, line1);
-    std::getline(istream, line2);
-
-    std::stringstream ss(line1);
-    Wire wire1 = ReadOneWire(ss);
-    ss.str(line2);
-    ss.clear();
-    Wire wire2 = ReadOneWire(ss);
-
-    return {wire1, wire2};
+// One wire per line, however many lines there are
+std::vector<Wire> ReadWires(std::istream& istream) {
+    std::vector<Wire> wires;
+    std::string line;
+    while (std::getline(istream, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        std::stringstream ss(line);
+        wires.push_back(ReadOneWire(ss));
+    }
+    return wires;
 }
 
-Point Intersection(Point a0, Point a1, Point b0, Point b1) {
-    if (a0.x == a1.x && b0.y == b1.y) {
-        if (a0.y > a1.y) {
-            return Intersection(a1, a0, b0, b1);
-        }
-        if (b0.x > b1.x) {
-            return Intersection(a0, a1, b1, b0);
+// A straight piece of wire. Steps are how far along the wire from the origin from is, before this segment
+struct Segment {
+    Point from;
+    int fixed;    // x of a vertical segment, y of a horizontal one
+    int low;      // Lowest y of a vertical segment, lowest x of a horizontal one
+    int high;
+    int64_t steps;
+};
+
+// A wire's segments, sorted for sweeping. Built once per wire and shared by every pair it's in
+struct WireIndex {
+    // Where a horizontal segment starts or ends along x. At the same x, starts come first
+    struct Edge {
+        int x;
+        bool end;
+        size_t segment;
+        bool operator<(const Edge& other) const {
+            return x != other.x ? x < other.x : end < other.end;
         }
-        if (a0.y <= b0.y && a1.y >= b1.y && b0.x <= a0.x && b1.x >= a1.x) {
-            return {a0.x, b0.y};
+    };
+    std::vector<Segment> horizontal;
+    std::vector<Edge> edges;
+    std::vector<Segment> vertical; // By x
+};
+
+// Zero length moves are dropped
+WireIndex IndexWire(const Wire& wire) {
+    WireIndex index;
+    int64_t steps = 0;
+    for (size_t i = 0; i + 1 < wire.size(); i++) {
+        const Point p0 = wire[i];
+        const Point p1 = wire[i + 1];
+        if (p0.y == p1.y && p0.x != p1.x) {
+            index.horizontal.push_back({p0, p0.y, std::min(p0.x, p1.x), std::max(p0.x, p1.x), steps});
+        } else if (p0.x == p1.x && p0.y != p1.y) {
+            index.vertical.push_back({p0, p0.x, std::min(p0.y, p1.y), std::max(p0.y, p1.y), steps});
         }
-        return {0, 0};
-    } else if (a0.y == a1.y && b0.x == b1.x) {
-        return Intersection(b0, b1, a0, a1);
-    } else {
-        return {0, 0};
+        steps += std::abs(static_cast<int64_t>(p1.x) - p0.x) + std::abs(static_cast<int64_t>(p1.y) - p0.y);
+    }
+    index.edges.reserve(2 * index.horizontal.size());
+    for (size_t i = 0; i < index.horizontal.size(); i++) {
+        index.edges.push_back({index.horizontal[i].low, false, i});
+        index.edges.push_back({index.horizontal[i].high, true, i});
     }
+    std::sort(index.edges.begin(), index.edges.end());
+    std::sort(index.vertical.begin(), index.vertical.end(), [](const Segment& a, const Segment& b) { return a.fixed < b.fixed; });
+    return index;
 }
 
-int ClosestIntersection(Wire a, Wire b) {
-    int shortestDistance = std::numeric_limits<int>::max();
-    for (size_t i = 0; i < a.size()-1; i++) {
-        Point a0 = a[i];
-        Point a1 = a[i+1]; 
-        
-        for (size_t j = 0; j < b.size()-1; j++) {
-            Point b0 = b[j];
-            Point b1 = b[j+1];
-    
-            Point p = Intersection(a0, a1, b0, b1);
-            if (p.x != 0 && p.y != 0) {
-                shortestDistance = std::min(shortestDistance, std::abs(p.x) + std::abs(p.y));
+// Sweeps a vertical line left to right over h's horizontal segments and v's vertical ones, keeping the horizontal
+// segments it is touching ordered by y. Each vertical segment then only looks at the horizontal ones in its y range.
+// Both are already sorted by x, so the sweep just merges them. Calls f(horizontal, vertical) for every pair that
+// cross, touching ends included
+template <typename F>
+void SweepCrossings(const WireIndex& h, const WireIndex& v, F&& f) {
+    using Active = std::multimap<int, const Segment*>;
+    Active active;
+    std::vector<Active::iterator> positions(h.horizontal.size());
+    size_t edge = 0;
+    for (const Segment& vertical : v.vertical) {
+        // At the same x, segments start before verticals are checked and end after
+        for (; edge < h.edges.size() && (h.edges[edge].x < vertical.fixed || (h.edges[edge].x == vertical.fixed && !h.edges[edge].end)); edge++) {
+            const WireIndex::Edge& e = h.edges[edge];
+            if (e.end) {
+                active.erase(positions[e.segment]);
+            } else {
+                positions[e.segment] = active.emplace(h.horizontal[e.segment].fixed, &h.horizontal[e.segment]);
             }
-        } 
+        }
+        for (auto it = active.lower_bound(vertical.low); it != active.end() && it->first <= vertical.high; ++it) {
+            f(*it->second, vertical);
+        }
     }
-    return shortestDistance;
 }
 
-int FewestCombinedSteps(Wire a, Wire b) {
-    int aSteps = 0;
-    for (size_t i = 0; i < a.size()-1; i++) {
-        Point a0 = a[i];
-        Point a1 = a[i+1]; 
-
-        int bSteps = 0;
-        for (size_t j = 0; j < b.size()-1; j++) {
-            Point b0 = b[j];
-            Point b1 = b[j+1];
-    
-            Point p = Intersection(a0, a1, b0, b1);
-            int aStepsToP = std::abs(p.x - a0.x) + std::abs(p.y - a0.y);
-            int bStepsToP = std::abs(p.x - b0.x) + std::abs(p.y - b0.y);
-            if (p.x != 0 && p.y != 0) {
-                return aSteps + bSteps + aStepsToP + bStepsToP; 
-            }
-            bSteps += std::abs(b1.x - b0.x) + std::abs(b1.y - b0.y);
-        } 
-        aSteps += std::abs(a1.x - a0.x) + std::abs(a1.y - a0.y);
+// Calls f(point, aSteps, bSteps) for every point where a and b cross at right angles, with how far along each wire
+// it is. Wires running along each other are not crossings
+template <typename F>
+void ForEachCrossing(const WireIndex& a, const WireIndex& b, F&& f) {
+    auto along = [](const Segment& s, Point p) {
+        return s.steps + std::abs(static_cast<int64_t>(p.x) - s.from.x) + std::abs(static_cast<int64_t>(p.y) - s.from.y);
+    };
+    SweepCrossings(a, b, [&](const Segment& h, const Segment& v) {
+        const Point p = {v.fixed, h.fixed};
+        f(p, along(h, p), along(v, p));
+    });
+    SweepCrossings(b, a, [&](const Segment& h, const Segment& v) {
+        const Point p = {v.fixed, h.fixed};
+        f(p, along(v, p), along(h, p));
+    });
+}
+
+// Both answers for a pair of wires. Either is -1 if the wires never cross
+struct Crossings {
+    int64_t closest = -1;     // Manhattan distance to the crossing closest to the origin
+    int64_t fewestSteps = -1; // Fewest steps both wires take between them to reach a crossing
+};
+
+// A wire passing the same point twice crosses there twice, and the earlier pass has the fewer steps. The origin,
+// where every wire starts, doesn't count
+Crossings FindCrossings(const WireIndex& a, const WireIndex& b) {
+    Crossings crossings;
+    ForEachCrossing(a, b, [&](Point p, int64_t aSteps, int64_t bSteps) {
+        if (p.x == 0 && p.y == 0) {
+            return;
+        }
+        const int64_t distance = std::abs(static_cast<int64_t>(p.x)) + std::abs(static_cast<int64_t>(p.y));
+        if (crossings.closest < 0 || distance < crossings.closest) {
+            crossings.closest = distance;
+        }
+        if (crossings.fewestSteps < 0 || aSteps + bSteps < crossings.fewestSteps) {
+            crossings.fewestSteps = aSteps + bSteps;
+        }
+    });
+    return crossings;
+}
+
+struct PairCrossings {
+    size_t a, b;
+    Crossings crossings;
+};
+
+// Every pair of wires, a before b. With threadCount > 1 the pairs are handed out to that many worker threads
+std::vector<PairCrossings> AllCrossings(const std::vector<Wire>& wires, int threadCount) {
+    std::vector<WireIndex> indexes(wires.size());
+    std::vector<PairCrossings> pairs;
+    for (size_t a = 0; a < wires.size(); a++) {
+        for (size_t b = a + 1; b < wires.size(); b++) {
+            pairs.push_back({a, b, {}});
+        }
     }
-    return -1;
+
+    // Indexing is work too, so it's shared out the same way before any pair needs it
+    auto share = [threadCount](size_t count, const auto& task) {
+        std::atomic<size_t> next = 0;
+        auto worker = [&]() {
+            for (size_t i = next++; i < count; i = next++) {
+                task(i);
+            }
+        };
+        std::vector<std::thread> threads;
+        for (int i = 1; i < threadCount; i++) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    };
+    share(wires.size(), [&](size_t i) { indexes[i] = IndexWire(wires[i]); });
+    share(pairs.size(), [&](size_t i) { pairs[i].crossings = FindCrossings(indexes[pairs[i].a], indexes[pairs[i].b]); });
+    return pairs;
 }
 
 struct Args {
     std::string file = "day3.txt";
     std::string test = "";
     bool part2 = false;
+    int threads = 1; // Pairs of wires worked on at once. 0 uses every core
 };
 
 int main(int argc, char** argv) {
     clue::CommandLine<Args> cl;
     cl.Optional(&Args::test, "test");
     cl.Optional(&Args::part2, "part2");
+    cl.Optional(&Args::threads, "threads");
     cl.Positional(&Args::file, "file");
     auto args = cl.ParseArgs(argc, argv);
 
+    std::vector<Wire> wires;
     if (!args->test.empty()) {
         std::istringstream in(args->test);
-        auto [a, b] = ReadTwoWires(in);
-        if (!args->part2) {
-            int shortestDistance = ClosestIntersection(a, b);
-            std::cout << shortestDistance << "\n";
-        } else {
-            int steps = FewestCombinedSteps(a, b);
-            std::cout << steps << "\n";
-        }
+        wires = ReadWires(in);
     } else if (!args->file.empty()) {
         std::ifstream in(args->file);
-        auto [a, b] = ReadTwoWires(in);
-        if (!args->part2) {
-            int dist = ClosestIntersection(a, b);
-            std::cout << dist << "\n";
-        } else {
-            int steps = FewestCombinedSteps(a, b);
-            std::cout << steps << "\n";
+        if (!in) {
+            std::cerr << "can't open " << args->file << "\n";
+            return 1;
         }
+        wires = ReadWires(in);
     }
-}
+    if (wires.size() < 2) {
+        std::cerr << "need at least two wires\n";
+        return 1;
+    }
+    const int threads = args->threads ? args->threads : static_cast<int>(std::thread::hardware_concurrency());
+    const std::vector<PairCrossings> pairs = AllCrossings(wires, threads);
 
+    // Two wires is the puzzle, and gets just the answer. With more, every pair gets a line
+    if (pairs.size() == 1) {
+        const Crossings& crossings = pairs[0].crossings;
+        std::cout << (args->part2 ? crossings.fewestSteps : crossings.closest) << "\n";
+        return 0;
+    }
+    for (const PairCrossings& pair : pairs) {
+        std::cout << pair.a << " " << pair.b << ": closest " << pair.crossings.closest
+                  << ", fewest steps " << pair.crossings.fewestSteps << "\n";
+    }
+}
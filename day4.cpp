@@ -1,32 +1,56 @@
-
+#include "clue.h"
+#include <algorithm>
+#include <array>
 #include <string>
 #include <iostream>
-#include <cmath>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+// Enough for anything up to the largest int64_t
+constexpr int kMaxDigits = 19;
+
+// digits[i] is the ith digit of number from the left, written with exactly digitCount digits
+void ToDigits(int64_t number, int digitCount, int* digits) {
+    for (int i = digitCount - 1; i >= 0; i--) {
+        digits[i] = number % 10;
+        number /= 10;
+    }
+}
 
-bool CouldBePassword(int number) {
-    int digits[6];
-    for (int i = 5; i >= 0; i--) {
+bool CouldBePassword(int64_t number, int digitCount) {
+    int digits[kMaxDigits];
+    for (int i = digitCount - 1; i >= 0; i--) {
         digits[i] = number % 10;
         number /= 10;
     }
     bool adjacentSame = false;
     bool neverDecrease = true;
-    for (int i = 1; i < 6; i++) {
+    for (int i = 1; i < digitCount; i++) {
         adjacentSame  = adjacentSame  || (digits[i-1] == digits[i]);
         neverDecrease = neverDecrease && (digits[i-1] <= digits[i]);
     }
     return adjacentSame && neverDecrease;
 }
 
-bool NewRules(int number) {
-    int digits[8] = {-1, 0, 0, 0, 0, 0, 0, -1};
-    for (int i = 6; i >= 1; i--) {
+bool NewRules(int64_t number, int digitCount) {
+    int digits[kMaxDigits + 2];
+    digits[0] = -1;
+    digits[digitCount + 1] = -1;
+    for (int i = digitCount; i >= 1; i--) {
         digits[i] = number % 10;
         number /= 10;
     }
     bool adjacentSame = false;
     bool neverDecrease = true;
-    for (int i = 2; i < 7; i++) {
+    for (int i = 2; i < digitCount + 1; i++) {
         adjacentSame  = adjacentSame
             || (digits[i-2] != digits[i-1] && digits[i-1] == digits[i] && digits[i] != digits[i+1]);
         neverDecrease = neverDecrease && (digits[i-1] <= digits[i]);
@@ -34,20 +58,342 @@ bool NewRules(int number) {
     return adjacentSame && neverDecrease;
 }
 
-int main(int argc, char** argv) {
-    int min = 234208;
-    int max = 765869;
-    int possibles = 0;
-    int newPossibles = 0;
-    for (int n = min; n <= max; n++) {
-        if (CouldBePassword(n)) {
-            possibles++;
+// Counts passwords a digit at a time instead of a number at a time. Reading a password left to right, all that
+// matters about the digits so far is the last one, how long its run is and whether the repeat rule is met yet, so
+// the number of ways to finish one only depends on that and how many digits are left
+class PasswordCounter {
+  public:
+    PasswordCounter(int digits, bool newRules) : digits_(digits), newRules_(newRules), completions_((digits + 1) * kStates) {
+        for (int state = 0; state < kStates; state++) {
+            completions_[state] = Accepts(Unpack(state));
+        }
+        for (int remaining = 1; remaining <= digits; remaining++) {
+            for (int state = 0; state < kStates; state++) {
+                const State s = Unpack(state);
+                int64_t count = 0;
+                for (int d = s.last; d <= 9; d++) {
+                    count += Completions(remaining - 1, Next(s, d));
+                }
+                completions_[remaining * kStates + state] = count;
+            }
+        }
+    }
+
+    // Passwords among min..max, as numbers written with exactly digits digits, leading zeros and all
+    int64_t Count(int64_t min, int64_t max) const {
+        return CountUpTo(max) - CountUpTo(min - 1);
+    }
+
+    // Passwords <= limit. Every number with fewer digits than limit is counted straight from the table, and along
+    // the way so is every number that matches limit up to some digit and is smaller at it
+    int64_t CountUpTo(int64_t limit) const {
+        if (limit < 0) {
+            return 0;
+        }
+        int digits[kMaxDigits];
+        ToDigits(limit, digits_, digits);
+        int64_t count = 0;
+        State s = {0, 0, false};
+        for (int i = 0; i < digits_; i++) {
+            for (int d = s.last; d < digits[i]; d++) {
+                count += Completions(digits_ - 1 - i, Next(s, d));
+            }
+            if (digits[i] < s.last) {
+                return count;
+            }
+            s = Next(s, digits[i]);
+        }
+        return count + Accepts(s);
+    }
+
+  private:
+    struct State {
+        int last;  // Last digit so far
+        int run;   // How many times in a row it's come up, 3 for 3 or more. 0 before the first digit
+        bool met;  // The repeat rule is met by a run that's over
+    };
+    static constexpr int kStates = 10 * 4 * 2;
+
+    static int Pack(State s) { return (s.last * 4 + s.run) * 2 + s.met; }
+    static State Unpack(int state) { return {state / 8, (state / 2) % 4, (state % 2) != 0}; }
+
+    State Next(State s, int digit) const {
+        if (s.run > 0 && digit == s.last) {
+            return {digit, std::min(s.run + 1, 3), s.met || !newRules_};
+        }
+        // A run of exactly two is only known to be exactly two once a different digit comes along
+        return {digit, 1, s.met || (newRules_ && s.run == 2)};
+    }
+
+    bool Accepts(State s) const {
+        return s.met || (newRules_ && s.run == 2);
+    }
+
+    int64_t Completions(int remaining, State s) const {
+        return completions_[remaining * kStates + Pack(s)];
+    }
+
+    int digits_;
+    bool newRules_;
+    std::vector<int64_t> completions_; // By digits remaining, then state
+};
+
+// Calls f(digits) for every number in min..max whose digits never decrease, in order. Goes straight from one to the
+// next instead of looking at every number in between, which for six digits skips all but 5005 of a million
+template <typename F>
+void ForEachNonDecreasing(int64_t min, int64_t max, int digitCount, F&& f) {
+    if (min > max) {
+        return;
+    }
+    // The first one from min keeps min's digits up to where they first go down, then repeats the digit before that
+    int digits[kMaxDigits];
+    ToDigits(min, digitCount, digits);
+    for (int i = 1; i < digitCount; i++) {
+        if (digits[i] < digits[i - 1]) {
+            std::fill(digits + i, digits + digitCount, digits[i - 1]);
+            break;
+        }
+    }
+    while (true) {
+        // Nineteen nines don't fit in an int64_t
+        uint64_t number = 0;
+        for (int i = 0; i < digitCount; i++) {
+            number = number * 10 + digits[i];
+        }
+        if (number > static_cast<uint64_t>(max)) {
+            return;
+        }
+        f(static_cast<const int*>(digits));
+        // The next one bumps the last digit that isn't a 9 and repeats it to the end
+        int i = digitCount - 1;
+        while (i >= 0 && digits[i] == 9) {
+            i--;
+        }
+        if (i < 0) {
+            return;
+        }
+        std::fill(digits + i, digits + digitCount, digits[i] + 1);
+    }
+}
+
+// Candidates checked together, one row per digit with a lane per candidate. Rows 0 and digits + 1 are -1, like
+// the ends NewRules puts around a number, so the runs at either end need no special case
+struct CandidateBatch {
+    static constexpr int kLanes = 16;
+    using LaneMask = uint32_t;
+
+    explicit CandidateBatch(int digitCount) : digitCount(digitCount) {
+        std::fill(rows[0], rows[0] + kLanes, -1);
+        std::fill(rows[digitCount + 1], rows[digitCount + 1] + kLanes, -1);
+    }
+
+    void Add(const int* digits) {
+        for (int i = 0; i < digitCount; i++) {
+            rows[i + 1][count] = static_cast<int16_t>(digits[i]);
+        }
+        count++;
+    }
+
+    bool Full() const { return count == kLanes; }
+
+    int digitCount;
+    int count = 0;
+    alignas(32) int16_t rows[kMaxDigits + 2][kLanes] = {};
+};
+
+// Lanes of a batch that pass CouldBePassword and NewRules
+struct Verdicts {
+    CandidateBatch::LaneMask passwords = 0;
+    CandidateBatch::LaneMask newPasswords = 0;
+};
+
+// The lane loops are written for the compiler to vectorize, and spelled out with AVX2 intrinsics in builds that
+// have it (-mavx2 or -march=native). A lane is 16 bits, so one register holds a whole batch
+Verdicts Validate(const CandidateBatch& batch) {
+    const int digitCount = batch.digitCount;
+    const CandidateBatch::LaneMask live = (CandidateBatch::LaneMask{1} << batch.count) - 1;
+    Verdicts verdicts;
+#if defined(__AVX2__)
+    auto row = [&](int i) { return _mm256_load_si256(reinterpret_cast<const __m256i*>(batch.rows[i])); };
+    // One bit per lane, in lane order. Packing works within each 128 bit half, so the halves are put back together
+    auto laneMask = [](__m256i v) {
+        const __m256i bytes = _mm256_permute4x64_epi64(_mm256_packs_epi16(v, _mm256_setzero_si256()), 0xD8);
+        return static_cast<CandidateBatch::LaneMask>(_mm256_movemask_epi8(bytes)) & 0xFFFF;
+    };
+    __m256i decrease = _mm256_setzero_si256();
+    __m256i same = _mm256_setzero_si256();
+    __m256i exactlyTwo = _mm256_setzero_si256();
+    // Whether digits i-1 and i, i and i+1, and i+1 and i+2 match. The ends never match a digit
+    __m256i before = _mm256_setzero_si256();
+    __m256i current = row(1);
+    __m256i next = row(2);
+    __m256i pair = _mm256_cmpeq_epi16(current, next);
+    for (int i = 1; i < digitCount; i++) {
+        const __m256i after = row(i + 2);
+        const __m256i nextPair = _mm256_cmpeq_epi16(next, after);
+        decrease = _mm256_or_si256(decrease, _mm256_cmpgt_epi16(current, next));
+        same = _mm256_or_si256(same, pair);
+        exactlyTwo = _mm256_or_si256(exactlyTwo, _mm256_andnot_si256(_mm256_or_si256(before, nextPair), pair));
+        before = pair;
+        pair = nextPair;
+        current = next;
+        next = after;
+    }
+    verdicts.passwords = laneMask(_mm256_andnot_si256(decrease, same)) & live;
+    verdicts.newPasswords = laneMask(_mm256_andnot_si256(decrease, exactlyTwo)) & live;
+#else
+    constexpr int kLanes = CandidateBatch::kLanes;
+    bool decrease[kLanes] = {};
+    bool same[kLanes] = {};
+    bool exactlyTwo[kLanes] = {};
+    for (int i = 1; i < digitCount; i++) {
+        const int16_t* a = batch.rows[i - 1];
+        const int16_t* b = batch.rows[i];
+        const int16_t* c = batch.rows[i + 1];
+        const int16_t* d = batch.rows[i + 2];
+        for (int lane = 0; lane < kLanes; lane++) {
+            decrease[lane] |= b[lane] > c[lane];
+            same[lane] |= b[lane] == c[lane];
+            exactlyTwo[lane] |= a[lane] != b[lane] && b[lane] == c[lane] && c[lane] != d[lane];
+        }
+    }
+    for (int lane = 0; lane < kLanes; lane++) {
+        verdicts.passwords |= static_cast<CandidateBatch::LaneMask>(same[lane] && !decrease[lane]) << lane;
+        verdicts.newPasswords |= static_cast<CandidateBatch::LaneMask>(exactlyTwo[lane] && !decrease[lane]) << lane;
+    }
+    verdicts.passwords &= live;
+    verdicts.newPasswords &= live;
+#endif
+    return verdicts;
+}
+
+// Collects output and hands it to the file in big blocks, rather than a write per line
+class BufferedWriter {
+  public:
+    explicit BufferedWriter(FILE* file) : file_(file) {}
+    ~BufferedWriter() { Flush(); }
+
+    void Write(const char* data, size_t size) {
+        if (used_ + size > buffer_.size()) {
+            Flush();
+        }
+        std::copy(data, data + size, buffer_.data() + used_);
+        used_ += size;
+    }
+
+    void Flush() {
+        fwrite(buffer_.data(), 1, used_, file_);
+        used_ = 0;
+    }
+
+  private:
+    FILE* file_;
+    std::array<char, 1 << 16> buffer_;
+    size_t used_ = 0;
+};
+
+// Writes every password in min..max, a line each, under the new rules or the old
+void ListPasswords(int64_t min, int64_t max, int digitCount, bool newRules, BufferedWriter& out) {
+    CandidateBatch batch(digitCount);
+    auto check = [&]() {
+        const Verdicts verdicts = Validate(batch);
+        const CandidateBatch::LaneMask passwords = newRules ? verdicts.newPasswords : verdicts.passwords;
+        char line[kMaxDigits + 1];
+        for (int lane = 0; lane < batch.count; lane++) {
+            if (passwords & (CandidateBatch::LaneMask{1} << lane)) {
+                for (int i = 0; i < digitCount; i++) {
+                    line[i] = static_cast<char>('0' + batch.rows[i + 1][lane]);
+                }
+                line[digitCount] = '\n';
+                out.Write(line, digitCount + 1);
+            }
+        }
+        batch.count = 0;
+    };
+    ForEachNonDecreasing(min, max, digitCount, [&](const int* digits) {
+        batch.Add(digits);
+        if (batch.Full()) {
+            check();
         }
-        if (NewRules(n)) {
-            newPossibles++;
+    });
+    if (batch.count > 0) {
+        check();
+    }
+}
+
+// The whole string as a non-negative int64_t
+bool ParseNumber(const std::string& s, int64_t& number) {
+    char* end = nullptr;
+    errno = 0;
+    const long long value = std::strtoll(s.c_str(), &end, 10);
+    if (s.empty() || *end != '\0' || errno == ERANGE || value < 0) {
+        return false;
+    }
+    number = value;
+    return true;
+}
+
+struct Args {
+    std::string min = "234208"; // Taken as strings, to go past what an int holds
+    std::string max = "765869";
+    int digits = 6;
+    bool bruteForce = false; // Test every number in the range, to check the counter against
+    bool list = false; // Write out the passwords themselves instead of counting them
+    bool part2 = false; // With -list, the passwords under the new rules
+};
+
+int main(int argc, char** argv) {
+    clue::CommandLine<Args> cl;
+    cl.Optional(&Args::min, "min");
+    cl.Optional(&Args::max, "max");
+    cl.Optional(&Args::digits, "digits");
+    cl.Optional(&Args::bruteForce, "bruteForce");
+    cl.Optional(&Args::list, "list");
+    cl.Optional(&Args::part2, "part2");
+    auto args = cl.ParseArgs(argc, argv);
+
+    int64_t min, max;
+    if (!ParseNumber(args->min, min) || !ParseNumber(args->max, max)) {
+        std::cerr << "-min and -max take whole numbers from 0 to " << INT64_MAX << "\n";
+        return 1;
+    }
+    if (args->digits < 1 || args->digits > kMaxDigits) {
+        std::cerr << "-digits takes 1 to " << kMaxDigits << "\n";
+        return 1;
+    }
+    int64_t limit = 1;
+    for (int i = 0; i < args->digits && limit <= INT64_MAX / 10; i++) {
+        limit *= 10;
+    }
+    if (args->digits < kMaxDigits && max >= limit) {
+        std::cerr << max << " has more than " << args->digits << " digits\n";
+        return 1;
+    }
+
+    if (args->list) {
+        BufferedWriter out(stdout);
+        ListPasswords(min, max, args->digits, args->part2, out);
+        return 0;
+    }
+
+    int64_t possibles = 0;
+    int64_t newPossibles = 0;
+    if (args->bruteForce) {
+        for (int64_t n = min; n <= max; n++) {
+            if (CouldBePassword(n, args->digits)) {
+                possibles++;
+            }
+            if (NewRules(n, args->digits)) {
+                newPossibles++;
+            }
+            if (n == INT64_MAX) {
+                break;
+            }
         }
+    } else if (min <= max) {
+        possibles = PasswordCounter(args->digits, false).Count(min, max);
+        newPossibles = PasswordCounter(args->digits, true).Count(min, max);
     }
     std::cout << possibles << "\n";
     std::cout << newPossibles << "\n";
 }
-
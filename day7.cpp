@@ -1,201 +1,327 @@
 
 #include "clue.h"
+#include "intcode.h"
+#include "intcode_image.h"
+#include "intcode_batch.h"
+#include "intcode_memo.h"
+#if defined(__cpp_impl_coroutine)
+#include "intcode_coro.h"
+#endif
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <array>
 #include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <thread>
 
-constexpr int ADD           = 1;
-constexpr int MULT          = 2;
-constexpr int INPUT         = 3;
-constexpr int OUTPUT        = 4;
-constexpr int JUMP_IF_TRUE  = 5;
-constexpr int JUMP_IF_FALSE = 6;
-constexpr int LESS_THAN     = 7;
-constexpr int EQUALS        = 8;
-constexpr int HALT          = 99;
-
-constexpr int POSITION_MODE  = 0;
-constexpr int IMMEDIATE_MODE = 1;
-
-int DecodeOpcode(std::vector<int>& memory, int pc, int* parameters[4]) {
-    int opcode = memory[pc];
-    int op = opcode % 100;
-    int n = 0;
-    switch (op) {
-        case ADD:
-        case MULT:
-        case LESS_THAN:
-        case EQUALS:
-            n = 3;
-            break;
-        case JUMP_IF_TRUE:
-        case JUMP_IF_FALSE:
-            n = 2;
-            break;
-        case INPUT:
-        case OUTPUT:
-            n = 1;
-            break;
-        default:
-            break;
-    }
-    opcode /= 100;
-    for (int i = 0; i < n; i++) {
-        int paramMode = opcode % 10;
-        switch (paramMode) {
-            case POSITION_MODE: 
-                parameters[i] = &(memory[memory[pc+i+1]]);
-                break;
-            case IMMEDIATE_MODE: 
-                parameters[i] = &(memory[pc+i+1]);
-                break;
+using Signals = Channel<int, 64>;
+
+struct Amplifier {
+    Intcode<int> intcode;
+    Signals inputs;
+    Signals* outputs;
+    bool halted = false;
+};
+
+// The most recent signal left in a channel
+int LastSignal(Signals& signals) {
+    int signal = 0;
+    while (signals.TryPop(signal)) {}
+    return signal;
+}
+
+// Part 1. Every amplifier runs once, feeding its output to the next
+int RunChain(const Intcode<int>& program, const std::vector<int>& phases) {
+    std::vector<Amplifier> amps(phases.size());
+    Signals outputs;
+    for (size_t i = 0; i < amps.size(); i++) {
+        amps[i].intcode = Fork(program);
+        amps[i].outputs = (i + 1 < amps.size()) ? &amps[i+1].inputs : &outputs;
+        amps[i].inputs.TryPush(phases[i]);
+    }
+    amps[0].inputs.TryPush(0);
+    for (auto& amp : amps) {
+        RunProgram(amp.intcode, &amp.inputs, amp.outputs);
+    }
+    return LastSignal(outputs);
+}
+
+// Part 1 as a search over the tree of phase prefixes. Every ordering that starts with a prefix shares its signal,
+// so each prefix is only worked out once, and an amplifier handed a phase and signal it has seen before isn't run
+// at all. Phases may repeat, which gives the same orderings as next_permutation
+void SearchPrefixes(size_t program, RunCache<int>& cache, std::vector<int>& remaining, int signal, int& maxSignal) {
+    if (remaining.empty()) {
+        maxSignal = std::max(maxSignal, signal);
+        return;
+    }
+    for (size_t i = 0; i < remaining.size(); i++) {
+        if (i > 0 && remaining[i] == remaining[i - 1]) {
+            continue;
         }
-        opcode /= 10;
+        const int phase = remaining[i];
+        const std::vector<int>& outputs = cache.Outputs(program, {phase, signal});
+        remaining.erase(remaining.begin() + i);
+        SearchPrefixes(program, cache, remaining, outputs.empty() ? 0 : outputs.back(), maxSignal);
+        remaining.insert(remaining.begin() + i, phase);
     }
-    return op;
 }
 
-bool RunProgram(std::vector<int>& memory, int& pc, std::deque<int>* inputs, std::deque<int>* outputs) {
-    int* params[4];
-
-    while (true) {
-        int op = DecodeOpcode(memory, pc, params);
-        switch(op) {
-            case ADD:
-                *params[2] = *params[0] + *params[1];
-                pc += 4;
-                break;
-            case MULT:
-                *params[2] = *params[0] * *params[1];
-                pc += 4;
-                break;
-            case INPUT:
-                if (inputs->empty()) {
-                    return false;
-                }
-                *params[0] = inputs->front();
-                inputs->pop_front();
-                pc += 2;
-                break;
-            case OUTPUT: 
-                outputs->push_back(*params[0]);
-                pc += 2;
-                break;
-            case JUMP_IF_TRUE:
-                pc = (*params[0]) ? *params[1] : pc + 3;
-                break;
-            case JUMP_IF_FALSE: 
-                pc = (!*params[0]) ? *params[1] : pc + 3;
-                break;
-            case LESS_THAN:
-                *params[2] = (*params[0] < *params[1]);
-                pc += 4;
-                break;
-            case EQUALS:
-                *params[2] = (*params[0] == *params[1]);
-                pc += 4;
-                break;
-            case HALT:
-                return true;
+int MaxSignalPrefixTree(const Intcode<int>& program, const std::vector<int>& phases) {
+    RunCache<int> cache;
+    std::vector<int> remaining = phases;
+    std::sort(remaining.begin(), remaining.end());
+    int maxSignal = std::numeric_limits<int>::min();
+    SearchPrefixes(cache.AddProgram(program), cache, remaining, 0, maxSignal);
+    return maxSignal;
+}
+
+// Part 2. The last amplifier feeds the first and they take turns on one thread until all of them halt
+int RunFeedbackLoop(const Intcode<int>& program, const std::vector<int>& phases) {
+    std::vector<Amplifier> amps(phases.size());
+    for (size_t i = 0; i < amps.size(); i++) {
+        amps[i].intcode = Fork(program);
+        amps[i].outputs = &amps[(i + 1) % amps.size()].inputs;
+        amps[i].inputs.TryPush(phases[i]);
+    }
+    amps[0].inputs.TryPush(0);
+    size_t running = amps.size();
+    for (size_t i = 0; running > 0; i = (i + 1) % amps.size()) {
+        if (!amps[i].halted && RunProgram(amps[i].intcode, &amps[i].inputs, amps[i].outputs) == kHalt) {
+            amps[i].halted = true;
+            running--;
         }
-   }
+    }
+    return LastSignal(amps[0].inputs);
 }
 
-std::vector<int> ReadProgram(std::istream& istream) {
-    char comma;
-    int opcode;
-    std::vector<int> program;
-    while (istream.good()) {
-        istream >> opcode;
-        istream >> comma;
-        program.push_back(opcode);
+// Part 2 with every amplifier on its own thread. Amplifier i blocks on channel i and writes to channel i+1.
+// When it stops it closes channel i+1 and abandons channel i, so nobody waits on a dead neighbour either way
+int RunFeedbackLoopThreaded(const Intcode<int>& program, const std::vector<int>& phases) {
+    std::vector<Signals> channels(phases.size());
+    for (size_t i = 0; i < phases.size(); i++) {
+        channels[i].TryPush(phases[i]);
     }
-    return program;
+    channels[0].TryPush(0);
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < phases.size(); i++) {
+        threads.emplace_back([&, i]() {
+            Intcode<int> intcode = Fork(program);
+            Signals* inputs = &channels[i];
+            Signals* outputs = &channels[(i + 1) % channels.size()];
+            RunProgram(intcode, BlockingChannelInput<int, 64>{inputs}, BlockingChannelOutput<int, 64>{outputs});
+            inputs->Abandon();
+            outputs->Close();
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return LastSignal(channels[0]);
 }
 
-struct Amplifier {
-    std::vector<int> program;
-    int pc = 0;
-    std::deque<int> inputs;
-    std::deque<int>* outputs;
-    bool halted = false;
-};
+#if defined(__cpp_impl_coroutine)
+// Part 2 with every amplifier as a coroutine. The scheduler only resumes an amplifier once a signal has been
+// delivered to it. Needs C++20
+int RunFeedbackLoopCoroutines(const Intcode<int>& program, const std::vector<int>& phases) {
+    Scheduler<int> scheduler;
+    std::vector<Intcode<int>> intcodes(phases.size(), Fork(program));
+    std::deque<Mailbox<int>> mailboxes;
+    for (size_t i = 0; i < phases.size(); i++) {
+        mailboxes.emplace_back(scheduler);
+        mailboxes.back().Push(phases[i]);
+    }
+    mailboxes[0].Push(0);
+    for (size_t i = 0; i < phases.size(); i++) {
+        scheduler.Spawn(intcodes[i], mailboxes[i], mailboxes[(i + 1) % mailboxes.size()]);
+    }
+    scheduler.Run();
+
+    int signal = 0;
+    while (mailboxes[0].TryPop(signal)) {}
+    return signal;
+}
+#endif
+
+std::vector<std::vector<int>> Orderings(const std::vector<int>& phases) {
+    std::vector<std::vector<int>> orderings;
+    std::vector<int> ordering = phases;
+    std::sort(ordering.begin(), ordering.end());
+    do {
+        orderings.push_back(ordering);
+    } while (std::next_permutation(ordering.begin(), ordering.end()));
+    return orderings;
+}
+
+// Runs every ordering of phases and returns the strongest signal. With threadCount > 1 the orderings are
+// handed out to that many worker threads
+int MaxSignal(const std::vector<int>& phases, int threadCount, const std::function<int(const std::vector<int>&)>& run) {
+    const std::vector<std::vector<int>> orderings = Orderings(phases);
+
+    std::atomic<size_t> next = 0;
+    std::atomic<int> maxSignal = std::numeric_limits<int>::min();
+    auto worker = [&]() {
+        for (size_t i = next++; i < orderings.size(); i = next++) {
+            int signal = run(orderings[i]);
+            int current = maxSignal;
+            while (signal > current && !maxSignal.compare_exchange_weak(current, signal)) {}
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < threadCount; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return maxSignal;
+}
+
+// Every ordering at once on one thread, for either part. The program branches on its phase straight away, so
+// amplifiers only keep in step with amplifiers running the same phase. Each batch holds amplifiers with the same
+// phase at the same position in their chain: they are all handed a signal on the same pass and run the same code
+// for it. In part 1 the last amplifier's signal goes back to a first amplifier that has already halted
+int MaxSignalBatched(const Intcode<int>& program, const std::vector<int>& phases) {
+    constexpr size_t kLanes = Batch<int>::kLanes;
+    const std::vector<std::vector<int>> orderings = Orderings(phases);
+    const size_t length = phases.size();
+
+    struct Group {
+        Batch<int> batch;
+        size_t position;
+        std::vector<size_t> orderings; // By lane
+    };
+    struct Slot {
+        size_t group;
+        size_t lane;
+    };
+    // Batches are in order of position, so one pass over them takes every signal once round the loop
+    std::vector<Group> groups;
+    std::vector<std::vector<Slot>> slots(orderings.size(), std::vector<Slot>(length));
+    for (size_t position = 0; position < length; position++) {
+        std::map<int, std::vector<size_t>> byPhase;
+        for (size_t i = 0; i < orderings.size(); i++) {
+            byPhase[orderings[i][position]].push_back(i);
+        }
+        for (const auto& [phase, same] : byPhase) {
+            for (size_t begin = 0; begin < same.size(); begin += kLanes) {
+                const size_t count = std::min(kLanes, same.size() - begin);
+                Group group{Batch<int>(program, count), position, {}};
+                for (size_t lane = 0; lane < count; lane++) {
+                    group.orderings.push_back(same[begin + lane]);
+                    group.batch.Inputs(lane).push_back(phase);
+                    slots[same[begin + lane]][position] = {groups.size(), lane};
+                }
+                groups.push_back(std::move(group));
+            }
+        }
+    }
+    for (size_t i = 0; i < orderings.size(); i++) {
+        groups[slots[i][0].group].batch.Inputs(slots[i][0].lane).push_back(0);
+    }
+
+    std::vector<int> signals(orderings.size());
+    bool running = true;
+    while (running) {
+        running = false;
+        for (Group& group : groups) {
+            running |= group.batch.Run() != kHalt;
+            for (size_t lane = 0; lane < group.orderings.size(); lane++) {
+                const size_t i = group.orderings[lane];
+                const Slot& next = slots[i][(group.position + 1) % length];
+                for (int signal : group.batch.Outputs(lane)) {
+                    groups[next.group].batch.Inputs(next.lane).push_back(signal);
+                    if (group.position + 1 == length) {
+                        signals[i] = signal;
+                    }
+                }
+                group.batch.Outputs(lane).clear();
+            }
+        }
+    }
+    return *std::max_element(signals.begin(), signals.end());
+}
 
 struct Args {
     std::string file = "day7.txt";
     std::string test = "";
     bool part2 = false;
+    std::vector<int> phases;
+    int threads = 1; // Phase orderings tried at once. 0 uses every core
+    bool pipeline = false; // Part 2 only. Run each amplifier on its own thread
+    bool coroutines = false; // Part 2 only. Run the amplifiers as coroutines on one thread
+    bool batch = false; // Run every ordering at once on one thread, in lockstep where the program allows
+    bool memo = false; // Part 1 only. Share the work for orderings with a common prefix
 };
 
 int main(int argc, char** argv) {
     clue::CommandLine<Args> cl;
     cl.Optional(&Args::test, "test");
     cl.Optional(&Args::part2, "part2");
+    cl.Optional(&Args::phases, "phases");
+    cl.Optional(&Args::threads, "threads");
+    cl.Optional(&Args::pipeline, "pipeline");
+    cl.Optional(&Args::coroutines, "coroutines");
+    cl.Optional(&Args::batch, "batch");
+    cl.Optional(&Args::memo, "memo");
     cl.Positional(&Args::file, "file");
     auto args = cl.ParseArgs(argc, argv);
 
-    std::vector<int> program;
+    Intcode<int> program;
 
     if (!args->test.empty()) {
         std::istringstream in(args->test);
-        program = ReadProgram(in);
+        program.memory = ReadProgram<int>(in);
     } else if (!args->file.empty()) {
-        std::ifstream file(args->file);
-        program = ReadProgram(file);
-    }
-
-    if (!args->part2) {
-        std::array<int, 5> phaseSettings = {0, 1, 2, 3, 4};
-        int maxSignal = 0;
-        while (std::next_permutation(phaseSettings.begin(), phaseSettings.end())) {
-            std::deque<int> outputs;
-            std::array<Amplifier, 5> amps;
-            for(int i = 0; i < 5; i++) {
-                amps[i].program = program;
-                amps[i].pc = 0;
-                if (i != 4) {
-                    amps[i].outputs = &amps[i+1].inputs;
-                } else {
-                    amps[4].outputs = &outputs;
-                }
-                amps[i].inputs.push_back(phaseSettings[i]);
-            }
-            amps[0].inputs.push_back(0);
-            for(int i = 0; i < 5; i++) {
-                RunProgram(amps[i].program, amps[i].pc, &amps[i].inputs, amps[i].outputs);
-            }
-            maxSignal = std::max(maxSignal, outputs.back());
-        }
-        std::cout << maxSignal << "\n";
-    } else {
-        std::array<int, 5> phaseSettings = {5, 6, 7, 8, 9};
-        int maxSignal = 0;
-        while (std::next_permutation(phaseSettings.begin(), phaseSettings.end())) {
-            std::array<Amplifier, 5> amps;
-            for(int i = 0; i < 5; i++) {
-                amps[i].program = program;
-                amps[i].pc = 0;
-                if (i != 4) {
-                    amps[i].outputs = &amps[i+1].inputs;
-                } else {
-                    amps[4].outputs = &amps[0].inputs;
-                }
-                amps[i].inputs.push_back(phaseSettings[i]);
-                amps[i].halted = false;
-            }
-            amps[0].inputs.push_back(0);
-            int i = 0;
-            while (true) {
-                amps[i].halted = RunProgram(amps[i].program, amps[i].pc, &amps[i].inputs, amps[i].outputs);
-                if (std::all_of(amps.begin(), amps.end(), [](const auto& a) { return a.halted; })) break;
-                i = ++i % 5;
-            }
-            maxSignal = std::max(maxSignal, amps[4].outputs->back());
+        std::optional<Memory<int>> memory = OpenProgram<int>(args->file);
+        if (!memory) {
+            return 1;
         }
-        std::cout << maxSignal << "\n";
+        program.memory = std::move(*memory);
+    }
 
+    std::vector<int> phases = args->phases;
+    if (phases.empty()) {
+        phases = args->part2 ? std::vector<int>{5, 6, 7, 8, 9} : std::vector<int>{0, 1, 2, 3, 4};
     }
-}
+    int threads = args->threads ? args->threads : static_cast<int>(std::thread::hardware_concurrency());
 
+#if !defined(__cpp_impl_coroutine)
+    if (args->coroutines) {
+        std::cerr << "-coroutines needs a C++20 build\n";
+        return 1;
+    }
+#endif
+
+    auto run = [&](const std::vector<int>& ordering) {
+        if (!args->part2) {
+            return RunChain(program, ordering);
+        } else if (args->pipeline) {
+            return RunFeedbackLoopThreaded(program, ordering);
+        }
+#if defined(__cpp_impl_coroutine)
+        if (args->coroutines) {
+            return RunFeedbackLoopCoroutines(program, ordering);
+        }
+#endif
+        return RunFeedbackLoop(program, ordering);
+    };
+    if (args->memo) {
+        if (args->part2) {
+            std::cerr << "-memo is part 1 only, amplifiers in a feedback loop keep running\n";
+            return 1;
+        }
+        std::cout << MaxSignalPrefixTree(program, phases) << "\n";
+        return 0;
+    }
+    if (args->batch) {
+        std::cout << MaxSignalBatched(program, phases) << "\n";
+        return 0;
+    }
+    std::cout << MaxSignal(phases, threads, run) << "\n";
+}
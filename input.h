@@ -0,0 +1,164 @@
+#pragma once
+
+// Puzzle inputs read in one go. On POSIX systems files are mapped rather than read, and integers are parsed
+// straight out of the mapping without going through a stream
+
+#if defined(__unix__) || defined(__APPLE__)
+#define INPUT_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define INPUT_MMAP 0
+#endif
+
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+#include <cstring>
+
+// The bytes of a file. The mapping is private and writable, so users may scribble on it without touching the file.
+// data lives as long as owner, which is what to hold on to when keeping pointers into it
+struct InputFile {
+    char* data = nullptr;
+    size_t size = 0;
+    std::shared_ptr<void> owner;
+
+    const char* begin() const { return data; }
+    const char* end() const { return data + size; }
+};
+
+inline std::optional<InputFile> LoadInput(const std::string& path) {
+    InputFile input;
+#if INPUT_MMAP
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "can't open " << path << "\n";
+        return {};
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        std::cerr << "can't read " << path << "\n";
+        return {};
+    }
+    input.size = static_cast<size_t>(st.st_size);
+    if (input.size == 0) {
+        close(fd);
+        return input;
+    }
+    void* data = mmap(nullptr, input.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        std::cerr << "can't map " << path << "\n";
+        return {};
+    }
+    const size_t size = input.size;
+    input.data = static_cast<char*>(data);
+    input.owner = std::shared_ptr<void>(data, [size](void* p) { munmap(p, size); });
+#else
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        std::cerr << "can't open " << path << "\n";
+        return {};
+    }
+    std::vector<char> bytes;
+    char chunk[1 << 16];
+    size_t n;
+    while ((n = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        bytes.insert(bytes.end(), chunk, chunk + n);
+    }
+    std::fclose(file);
+    auto buffer = std::make_shared<std::vector<char>>(std::move(bytes));
+    input.data = buffer->data();
+    input.size = buffer->size();
+    input.owner = buffer;
+#endif
+    return input;
+}
+
+// Number of decimal digits at the start of the 8 bytes in chunk, which were loaded little-endian
+inline int LeadingDigits(uint64_t chunk) {
+    // A byte is a digit when its high nibble is 3 and adding 6 leaves it at 3. Carries out of a byte only reach
+    // bytes after it, which don't matter once it isn't a digit
+    const uint64_t high = chunk & 0xF0F0F0F0F0F0F0F0;
+    const uint64_t plus6 = (chunk + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0;
+    const uint64_t notDigit = (high ^ 0x3030303030303030) | (plus6 ^ 0x3030303030303030);
+    return notDigit == 0 ? 8 : __builtin_ctzll(notDigit) / 8;
+}
+
+// Value of the first n digits in chunk, 1 <= n <= 8
+inline uint64_t DigitsValue(uint64_t chunk, int n) {
+    // Shift the digits to the top so the bytes below them read as leading zeros, then combine pairs, quads and
+    // halves with three multiplies
+    uint64_t digits = (chunk - 0x3030303030303030) << (8 * (8 - n));
+    digits = digits * 10 + (digits >> 8);
+    return (((digits & 0x000000FF000000FF) * (100 + (1000000ULL << 32))) +
+            (((digits >> 16) & 0x000000FF000000FF) * (1 + (10000ULL << 32)))) >> 32;
+}
+
+// Appends every signed decimal integer in [begin, end) to values. Anything other than a digit or a minus sign
+// separates them, so comma and newline separated lists both work. Values must fit in T
+template <typename T>
+void ParseIntegers(const char* begin, const char* end, std::vector<T>& values) {
+    static constexpr uint64_t kPowersOf10[9] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+    const char* p = begin;
+    while (p < end) {
+        bool negative = false;
+        if (*p == '-' && p + 1 < end && static_cast<unsigned char>(p[1] - '0') < 10) {
+            negative = true;
+            p++;
+        } else if (static_cast<unsigned char>(*p - '0') >= 10) {
+            p++;
+            continue;
+        }
+        uint64_t value = 0;
+        while (end - p >= 8) {
+            uint64_t chunk;
+            std::memcpy(&chunk, p, sizeof(chunk));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            chunk = __builtin_bswap64(chunk);
+#endif
+            const int n = LeadingDigits(chunk);
+            if (n == 0) {
+                break;
+            }
+            value = value * kPowersOf10[n] + DigitsValue(chunk, n);
+            p += n;
+            if (n < 8) {
+                break;
+            }
+        }
+        // The last few bytes of the input
+        while (p < end && static_cast<unsigned char>(*p - '0') < 10) {
+            value = value * 10 + static_cast<uint64_t>(*p - '0');
+            p++;
+        }
+        values.push_back(static_cast<T>(negative ? 0 - value : value));
+    }
+}
+
+template <typename T>
+std::vector<T> ParseIntegers(const char* begin, const char* end) {
+    std::vector<T> values;
+    // Puzzle inputs average a few bytes per integer. Guessing low and growing beats counting separators first
+    values.reserve(static_cast<size_t>(end - begin) / 8);
+    ParseIntegers(begin, end, values);
+    return values;
+}
+
+// Every integer in the file at path
+template <typename T>
+std::optional<std::vector<T>> ReadIntegers(const std::string& path) {
+    std::optional<InputFile> input = LoadInput(path);
+    if (!input) {
+        return {};
+    }
+    return ParseIntegers<T>(input->begin(), input->end());
+}
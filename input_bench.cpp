@@ -0,0 +1,126 @@
+#include "clue.h"
+#include "input.h"
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+
+// Writes about megabytes of integers to path, mostly small like puzzle inputs with the odd wide or negative one
+void WriteSynthetic(const std::string& path, int megabytes, char separator) {
+    std::mt19937_64 rng(2019);
+    std::ofstream file(path, std::ios::binary);
+    const size_t target = static_cast<size_t>(megabytes) << 20;
+    std::string buffer;
+    size_t written = 0;
+    char number[24];
+    while (written < target) {
+        const uint64_t r = rng();
+        int64_t value;
+        switch (r % 8) {
+            case 0: value = static_cast<int64_t>(r >> 44); break;
+            case 1: value = -static_cast<int64_t>((r >> 8) % 100000); break;
+            case 2: value = static_cast<int64_t>(r >> 12); break;
+            default: value = static_cast<int64_t>((r >> 8) % 2000); break;
+        }
+        const int n = std::snprintf(number, sizeof(number), "%lld%c", static_cast<long long>(value), separator);
+        buffer.append(number, static_cast<size_t>(n));
+        if (buffer.size() > (1 << 20)) {
+            file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            written += buffer.size();
+            buffer.clear();
+        }
+    }
+    file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+}
+
+// How ReadProgram and day 1 used to read their input
+std::vector<int64_t> StreamIntegers(const std::string& path) {
+    std::ifstream file(path);
+    std::vector<int64_t> values;
+    int64_t value;
+    while (file >> value) {
+        values.push_back(value);
+        if (file.peek() == ',') {
+            file.get();
+        }
+    }
+    return values;
+}
+
+// std::from_chars over the same buffer, splitting numbers the way ParseIntegers does
+std::vector<int64_t> FromCharsIntegers(const char* p, const char* end) {
+    std::vector<int64_t> values;
+    auto isDigit = [](char c) { return c >= '0' && c <= '9'; };
+    while (p < end) {
+        if (isDigit(*p) || (*p == '-' && p + 1 < end && isDigit(p[1]))) {
+            int64_t value = 0;
+            p = std::from_chars(p, end, value).ptr;
+            values.push_back(value);
+        } else {
+            p++;
+        }
+    }
+    return values;
+}
+
+// Removes the file at path when it goes out of scope, however main returns
+struct ScratchFile {
+    std::string path;
+    ~ScratchFile() { std::remove(path.c_str()); }
+};
+
+template <typename F>
+double Seconds(F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+struct Args {
+    std::string file = ""; // Defaults to input_bench.txt in the temporary directory
+    int megabytes = 256;
+    bool newlines = false;
+};
+
+int main(int argc, char** argv) {
+    clue::CommandLine<Args> cl;
+    cl.Optional(&Args::megabytes, "megabytes");
+    cl.Optional(&Args::newlines, "newlines");
+    cl.Positional(&Args::file, "file", "Scratch file for the synthetic input, removed afterwards");
+    auto args = cl.ParseArgs(argc, argv);
+
+    const ScratchFile scratch = {args->file.empty() ? (std::filesystem::temp_directory_path() / "input_bench.txt").string() : args->file};
+    WriteSynthetic(scratch.path, args->megabytes, args->newlines ? '\n' : ',');
+    std::optional<InputFile> input = LoadInput(scratch.path);
+    if (!input) {
+        return 1;
+    }
+    const double megabytes = static_cast<double>(input->size) / (1 << 20);
+
+    std::vector<int64_t> streamed;
+    const double streamSeconds = Seconds([&]() { streamed = StreamIntegers(scratch.path); });
+    std::vector<int64_t> read;
+    const double readSeconds = Seconds([&]() { read = *ReadIntegers<int64_t>(scratch.path); });
+    std::vector<int64_t> parsed;
+    const double parseSeconds = Seconds([&]() { parsed = ParseIntegers<int64_t>(input->begin(), input->end()); });
+    std::vector<int64_t> fromChars;
+    const double fromCharsSeconds = Seconds([&]() { fromChars = FromCharsIntegers(input->begin(), input->end()); });
+
+    if (read != streamed || parsed != streamed) {
+        printf("ParseIntegers disagrees with std::istream\n");
+        return 1;
+    }
+    if (fromChars != streamed) {
+        printf("std::from_chars disagrees with std::istream\n");
+        return 1;
+    }
+    printf("%.0f MB, %zu integers\n", megabytes, streamed.size());
+    printf("  istream:        %8.1f MB/s\n", megabytes / streamSeconds);
+    printf("  ReadIntegers:   %8.1f MB/s (%.2fx)\n", megabytes / readSeconds, streamSeconds / readSeconds);
+    printf("  ParseIntegers:  %8.1f MB/s (%.2fx), parsing only\n", megabytes / parseSeconds, streamSeconds / parseSeconds);
+    printf("  from_chars:     %8.1f MB/s (%.2fx), parsing only\n", megabytes / fromCharsSeconds, streamSeconds / fromCharsSeconds);
+}
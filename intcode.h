@@ -0,0 +1,980 @@
+#pragma once
+
+#include "channel.h"
+#include "input.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <cstdint>
+
+constexpr int ADD           = 1;
+constexpr int MULT          = 2;
+constexpr int INPUT         = 3;
+constexpr int OUTPUT        = 4;
+constexpr int JUMP_IF_TRUE  = 5;
+constexpr int JUMP_IF_FALSE = 6;
+constexpr int LESS_THAN     = 7;
+constexpr int EQUALS        = 8;
+constexpr int RELATIVE_ADJ  = 9;
+constexpr int HALT          = 99;
+
+constexpr int POSITION_MODE  = 0;
+constexpr int IMMEDIATE_MODE = 1;
+constexpr int RELATIVE_MODE  = 2;
+
+enum Interrupt {
+    kInput,
+    kOutput,
+    kHalt,
+    kBreak // Reached a kBreakHandler record. Only returned once something has set one
+};
+
+// Dispatch slots for decoded instructions. Slots 1-9 are the opcodes themselves, slots past kHaltHandler run
+// a fused sequence of instructions
+constexpr uint8_t kDecodeHandler      = 0;
+constexpr uint8_t kHaltHandler        = 10;
+constexpr uint8_t kCompareJumpHandler = 11; // LESS_THAN or EQUALS, then a JUMP_IF_* testing the result
+constexpr uint8_t kAdjustJumpHandler  = 12; // RELATIVE_ADJ, then a JUMP_IF_*. Calls and returns
+constexpr uint8_t kArithRunHandler    = 13; // Two or three ADD/MULTs in a row
+constexpr uint8_t kBreakHandler       = 14; // Interrupt with kBreak before running the instruction. Set by the JIT
+
+constexpr int kMaxLength = 4; // Most cells one instruction covers
+constexpr int kMaxSpan = 12;  // Most cells a fused instruction covers
+
+enum Dispatch {
+    kSwitchDispatch,
+    kThreadedDispatch
+};
+
+// Threaded dispatch needs labels-as-values. The switch stays the default, as intcode_bench has threaded no faster
+// on day 9 or day 13. Build with -DINTCODE_DISPATCH=kThreadedDispatch to try it
+#if defined(__GNUC__) || defined(__clang__)
+#define INTCODE_COMPUTED_GOTO 1
+#else
+#define INTCODE_COMPUTED_GOTO 0
+#endif
+
+#ifndef INTCODE_DISPATCH
+#define INTCODE_DISPATCH kSwitchDispatch
+#endif
+
+constexpr Dispatch kDefaultDispatch = INTCODE_DISPATCH;
+
+// Build with -DINTCODE_PROFILE=1 to have RunProgram count what it executes. Compiled out, the hooks below expand
+// to nothing and RunProgram is the same code as before
+#ifndef INTCODE_PROFILE
+#define INTCODE_PROFILE 0
+#endif
+
+// Superinstructions are on unless profiling, which should see the program's own instruction stream
+#ifndef INTCODE_FUSE
+#define INTCODE_FUSE !INTCODE_PROFILE
+#endif
+
+#if INTCODE_PROFILE && INTCODE_FUSE
+#error "INTCODE_PROFILE counts unfused instructions, build it with INTCODE_FUSE=0"
+#endif
+
+// Instruction::flags
+constexpr uint8_t kCodeFlag      = 1; // The cell is in the span of a decoded record, so writing it may be self-modifying
+constexpr uint8_t kFusedFlag     = 2; // The cell may be in the span of a fused record
+constexpr uint8_t kRewrittenFlag = 4; // The record was dropped by a self-modifying write. Never fused again
+
+// An instruction with its opcode split into a dispatch slot and parameter modes
+template <typename Cell>
+struct Instruction {
+    uint8_t handler = kDecodeHandler;
+    uint8_t opcode = 0; // Still the instruction's own opcode when handler runs a fused sequence
+    uint8_t length = 0;
+    uint8_t span = 0;   // Cells this record depends on. Longer than length when later instructions are fused in
+    uint8_t flags = 0;  // About this cell of the cache rather than the instruction, so decoding keeps them
+    uint8_t modes[3] = {};
+    Cell operands[3] = {};
+};
+
+#if defined(__GNUC__) || defined(__clang__)
+#define INTCODE_NOINLINE __attribute__((noinline))
+#else
+#define INTCODE_NOINLINE
+#endif
+
+// Memory is split into 4 KiB pages held by shared_ptr. Copying a Memory shares every page and a page is only
+// cloned when one of the copies writes to it, so forking a VM costs O(pages touched) instead of O(program size).
+// Pages within the first 64K are found through a flat directory, so the common case is one bounds check.
+// Far flung addresses go through a hash map. Reads of untouched cells return 0 without allocating.
+template <typename Cell>
+class Memory {
+  public:
+    static constexpr size_t kPageCells = 4096 / sizeof(Cell);
+    static constexpr size_t kDirectoryPages = 1 << 16;
+    using Page = std::array<Cell, kPageCells>;
+    using Address = std::make_unsigned_t<Cell>;
+
+    Memory() = default;
+    Memory(const std::vector<Cell>& image) : imageSize_(image.size()) {
+        directory_.resize((image.size() + kPageCells - 1) / kPageCells);
+        for (size_t page = 0; page < directory_.size(); page++) {
+            directory_[page] = std::make_shared<Page>();
+            const size_t begin = page * kPageCells;
+            const size_t end = std::min(image.size(), begin + kPageCells);
+            std::copy(image.begin() + begin, image.begin() + end, directory_[page]->begin());
+        }
+    }
+
+    // An image that lives in someone else's buffer, like a mapped file, for as long as owner is held. Whole pages
+    // are used where they are and the partial page at the end is copied. Each page holds owner through its own
+    // count, so a page no copy shares is written in place like any other. Cells must be writable and private to
+    // this Memory and its copies
+    Memory(Cell* cells, size_t count, const std::shared_ptr<void>& owner) : imageSize_(count) {
+        directory_.resize((count + kPageCells - 1) / kPageCells);
+        for (size_t page = 0; page < directory_.size(); page++) {
+            const size_t begin = page * kPageCells;
+            if (begin + kPageCells <= count) {
+                directory_[page] = std::shared_ptr<Page>(reinterpret_cast<Page*>(cells + begin), [owner](Page*) {});
+            } else {
+                directory_[page] = std::make_shared<Page>();
+                std::copy(cells + begin, cells + count, directory_[page]->begin());
+            }
+        }
+    }
+
+    Cell Load(Cell address) const {
+        const Address a = static_cast<Address>(address);
+        const Address page = a / kPageCells;
+        if (page < directory_.size()) {
+            const Page* p = directory_[page].get();
+            return p ? (*p)[a % kPageCells] : 0;
+        }
+        return LoadSparse(a);
+    }
+
+    void Store(Cell address, Cell value) {
+        (*this)[address] = value;
+    }
+
+    // Writable reference to a cell, cloning or allocating its page first if needed
+    Cell& operator[](Cell address) {
+        const Address a = static_cast<Address>(address);
+        const Address page = a / kPageCells;
+        if (page < directory_.size()) {
+            const auto& p = directory_[page];
+            if (p && p.use_count() == 1) {
+                return (*p)[a % kPageCells];
+            }
+        }
+        return MakeWritable(a);
+    }
+
+    // Overwrite this memory with other's contents without sharing any pages. Pages this copy already owns are
+    // reused, so a scratch VM can be reset between runs without allocating
+    void Assign(const Memory& other) {
+        imageSize_ = other.imageSize_;
+        directory_.resize(std::max(directory_.size(), other.directory_.size()));
+        for (size_t page = 0; page < directory_.size(); page++) {
+            auto& mine = directory_[page];
+            const Page* theirs = (page < other.directory_.size()) ? other.directory_[page].get() : nullptr;
+            if (mine && mine.use_count() == 1) {
+                if (theirs) {
+                    *mine = *theirs;
+                } else {
+                    mine->fill(0);
+                }
+            } else {
+                mine = theirs ? std::make_shared<Page>(*theirs) : nullptr;
+            }
+        }
+        sparse_.clear();
+        for (const auto& [page, p] : other.sparse_) {
+            sparse_[page] = std::make_shared<Page>(*p);
+        }
+    }
+
+    // The cells the program was loaded with, plus anything written over them since
+    std::vector<Cell> Image() const {
+        std::vector<Cell> image(imageSize_);
+        for (size_t i = 0; i < imageSize_; i++) {
+            image[i] = Load(static_cast<Cell>(i));
+        }
+        return image;
+    }
+    size_t ImageSize() const { return imageSize_; }
+
+    size_t PageCount() const {
+        return sparse_.size() + std::count_if(directory_.begin(), directory_.end(), [](const auto& p) { return p != nullptr; });
+    }
+
+    // Raw pages for generated code, which has to do its own bounds checks. Pages that were never written are null.
+    // A writable page is only handed out while no copy shares it, so it is good until this Memory is next copied
+    // or written through
+    size_t DirectoryPages() const { return directory_.size(); }
+    const Cell* PageData(size_t page) const {
+        const Page* p = directory_[page].get();
+        return p ? p->data() : nullptr;
+    }
+    Cell* OwnedPageData(size_t page) {
+        const auto& p = directory_[page];
+        return (p && p.use_count() == 1) ? p->data() : nullptr;
+    }
+
+    // Every page that has been allocated, as f(first address, cells). Directory pages come first, in order
+    template <typename F>
+    void ForEachPage(F&& f) const {
+        for (size_t page = 0; page < directory_.size(); page++) {
+            if (directory_[page]) {
+                f(static_cast<Address>(page * kPageCells), *directory_[page]);
+            }
+        }
+        for (const auto& [page, p] : sparse_) {
+            f(static_cast<Address>(page * kPageCells), *p);
+        }
+    }
+
+    // Pages this Memory shares with a fork or snapshot
+    size_t SharedPageCount() const {
+        auto shared = [](const auto& p) { return p && p.use_count() > 1; };
+        return std::count_if(directory_.begin(), directory_.end(), shared)
+             + std::count_if(sparse_.begin(), sparse_.end(), [&](const auto& kv) { return shared(kv.second); });
+    }
+
+  private:
+    // Kept out of line so RunProgram's loop only inlines the two fast paths above
+    INTCODE_NOINLINE Cell LoadSparse(Address a) const {
+        auto it = sparse_.find(a / kPageCells);
+        return (it != sparse_.end()) ? (*it->second)[a % kPageCells] : 0;
+    }
+
+    INTCODE_NOINLINE Cell& MakeWritable(Address a) {
+        const Address page = a / kPageCells;
+        std::shared_ptr<Page>* p;
+        if (page < kDirectoryPages) {
+            if (page >= directory_.size()) {
+                directory_.resize(page + 1);
+            }
+            p = &directory_[page];
+        } else {
+            p = &sparse_[page];
+        }
+        if (!*p) {
+            *p = std::make_shared<Page>();
+        } else if (p->use_count() > 1) {
+            *p = std::make_shared<Page>(**p);
+        }
+        return (**p)[a % kPageCells];
+    }
+
+    size_t imageSize_ = 0;
+    std::vector<std::shared_ptr<Page>> directory_;
+    std::unordered_map<Address, std::shared_ptr<Page>> sparse_;
+};
+
+// Cell is the machine word. Day 2 and day 5 programs fit in an int, everything from day 9 on needs int64_t
+// decoded is a per-pc cache of the program image that RunProgram fills lazily and invalidates on its own writes.
+// Reset it if memory is modified from outside RunProgram after the program has started.
+// Copying an Intcode is cheap: memory pages and the decode cache are shared until one side writes to them.
+template <typename Cell>
+struct Intcode {
+    Memory<Cell> memory;
+    Cell pc = 0;
+    Cell relativeBase = 0;
+    std::shared_ptr<std::vector<Instruction<Cell>>> decoded;
+    Cell decodedEnd = 0; // One past the last memory cell covered by a decoded instruction
+    uint64_t rewrites = 0; // Writes RunProgram has made to code cells, so code compiled elsewhere can tell it may be stale
+};
+
+// Snapshot a VM, or branch off one to explore from a known state. Same as a copy, spelled out for search code
+template <typename Cell>
+Intcode<Cell> Fork(const Intcode<Cell>& intcode) {
+    return intcode;
+}
+
+// Reset a scratch VM to a snapshot in place. Unlike Fork nothing is shared with the snapshot, and the scratch
+// VM's own pages and decode cache are reused, so a worker thread can run trial after trial without allocating
+template <typename Cell>
+void Restore(Intcode<Cell>& intcode, const Intcode<Cell>& snapshot) {
+    intcode.memory.Assign(snapshot.memory);
+    intcode.pc = snapshot.pc;
+    intcode.relativeBase = snapshot.relativeBase;
+    if (intcode.decoded && intcode.decoded.use_count() == 1 && intcode.decoded->size() == intcode.memory.ImageSize()) {
+        std::fill(intcode.decoded->begin(), intcode.decoded->end(), Instruction<Cell>{});
+    } else {
+        intcode.decoded.reset();
+    }
+    intcode.decodedEnd = 0;
+}
+
+// The handler, length and modes an opcode decodes to. Operands are left zero
+template <typename Cell>
+Instruction<Cell> DecodeOpcode(Cell opcode) {
+    Instruction<Cell> inst;
+    const int op = static_cast<int>(opcode % 100);
+    switch (op) {
+        case ADD:
+        case MULT:
+        case LESS_THAN:
+        case EQUALS:
+            inst.handler = static_cast<uint8_t>(op);
+            inst.length = 4;
+            break;
+        case JUMP_IF_TRUE:
+        case JUMP_IF_FALSE:
+            inst.handler = static_cast<uint8_t>(op);
+            inst.length = 3;
+            break;
+        case INPUT:
+        case OUTPUT:
+        case RELATIVE_ADJ:
+            inst.handler = static_cast<uint8_t>(op);
+            inst.length = 2;
+            break;
+        default:
+            // Unknown opcodes are treated as HALT
+            inst.handler = kHaltHandler;
+            inst.length = 1;
+            break;
+    }
+    inst.opcode = static_cast<uint8_t>(op);
+    inst.span = inst.length;
+    opcode /= 100;
+    for (int i = 0; i < inst.length - 1; i++) {
+        inst.modes[i] = static_cast<uint8_t>(opcode % 10);
+        opcode /= 10;
+    }
+    return inst;
+}
+
+template <typename Cell>
+Instruction<Cell> DecodeInstruction(const Memory<Cell>& memory, Cell pc) {
+    Instruction<Cell> inst = DecodeOpcode(memory.Load(pc));
+    for (int i = 0; i < inst.length - 1; i++) {
+        inst.operands[i] = memory.Load(pc + i + 1);
+    }
+    return inst;
+}
+
+// Decodes into a record of the decode cache, keeping the record's flags
+template <typename Cell>
+void DecodeInto(Instruction<Cell>& record, const Memory<Cell>& memory, Cell pc) {
+    const uint8_t flags = record.flags;
+    record = DecodeInstruction(memory, pc);
+    record.flags = flags;
+}
+
+// The superinstruction first and second make when second falls through from first, or kDecodeHandler if they
+// don't make one. Only sequences that are hot in the day 9 and day 13 profiles are fused (see Profile::pairs)
+template <typename Cell>
+uint8_t FusedHandler(const Instruction<Cell>& first, const Instruction<Cell>& second) {
+    if (first.handler == kDecodeHandler || first.handler == kBreakHandler || second.handler == kDecodeHandler ||
+        second.handler == kBreakHandler || ((first.flags | second.flags) & kRewrittenFlag)) {
+        return kDecodeHandler;
+    }
+    const bool jump = second.opcode == JUMP_IF_TRUE || second.opcode == JUMP_IF_FALSE;
+    switch (first.opcode) {
+        case LESS_THAN:
+        case EQUALS:
+            // The jump has to test the very cell the comparison wrote, so the result can be used without reloading it
+            if (jump && first.modes[2] != IMMEDIATE_MODE &&
+                second.modes[0] == first.modes[2] && second.operands[0] == first.operands[2]) {
+                return kCompareJumpHandler;
+            }
+            break;
+        case RELATIVE_ADJ:
+            if (jump) {
+                return kAdjustJumpHandler;
+            }
+            break;
+        case ADD:
+        case MULT:
+            if (second.opcode == ADD || second.opcode == MULT) {
+                return kArithRunHandler;
+            }
+            break;
+    }
+    return kDecodeHandler;
+}
+
+// Peephole pass run right after decoded[pc] is decoded. Fuses it into a superinstruction with whichever of its
+// neighbours are already decoded, so nothing is decoded ahead of execution and data is never mistaken for code.
+// A fused record's span covers every instruction in it, so a write to any of them drops it back to kDecodeHandler.
+// Code that has been rewritten once tends to be rewritten again (day 13 patches operands to index arrays), so
+// records dropped that way are left unfused rather than fused again on every decode
+template <typename Cell>
+void FuseInstructions(Instruction<Cell>* decoded, size_t decodedSize, Cell pc) {
+    auto fuse = [&](Cell at) {
+        if (at < 0) {
+            return;
+        }
+        Instruction<Cell>& head = decoded[at];
+        const Cell second = at + head.length;
+        if (head.handler == kDecodeHandler || static_cast<size_t>(second) >= decodedSize) {
+            return;
+        }
+        const uint8_t handler = FusedHandler(head, decoded[second]);
+        if (handler == kDecodeHandler) {
+            return;
+        }
+        head.handler = handler;
+        head.span = head.length + decoded[second].length;
+        const Cell third = second + decoded[second].length;
+        if (handler == kArithRunHandler && static_cast<size_t>(third) < decodedSize &&
+            FusedHandler(decoded[second], decoded[third]) == kArithRunHandler) {
+            head.span += decoded[third].length;
+        }
+        // The last instruction may run past the end of the image
+        for (Cell c = at; c < at + head.span && static_cast<size_t>(c) < decodedSize; c++) {
+            decoded[c].flags |= kFusedFlag;
+        }
+    };
+    fuse(pc);     // With the instruction after it
+    fuse(pc - 2); // RELATIVE_ADJ before it
+    fuse(pc - 4); // Comparison, ADD or MULT before it
+    fuse(pc - 8); // ADD/MULT run of three ending with it
+}
+
+// Input sinks are called as bool(Cell&). Returning false interrupts the program with kInput
+// and leaves pc on the INPUT instruction so RunProgram can be re-entered once there is more input.
+// Output sinks are called as void(Cell) or bool(Cell). Returning false means the sink is full and interrupts
+// the program with kOutput, again leaving pc on the instruction so it is retried on re-entry.
+
+template <typename Cell>
+struct DequeInput {
+    std::deque<Cell>* queue;
+    bool operator()(Cell& value) {
+        if (queue->empty()) {
+            return false;
+        }
+        value = queue->front();
+        queue->pop_front();
+        return true;
+    }
+};
+
+template <typename Cell>
+struct DequeOutput {
+    std::deque<Cell>* queue;
+    void operator()(Cell value) {
+        queue->push_back(value);
+    }
+};
+
+template <typename Cell, size_t Capacity>
+struct ChannelInput {
+    Channel<Cell, Capacity>* channel;
+    bool operator()(Cell& value) {
+        return channel->TryPop(value);
+    }
+};
+
+template <typename Cell, size_t Capacity>
+struct ChannelOutput {
+    Channel<Cell, Capacity>* channel;
+    bool operator()(Cell value) {
+        return channel->TryPush(value);
+    }
+};
+
+// For a VM that has a thread to itself. Waits for input, yielding the core between polls, and only gives up
+// with kInput once the producer has closed the channel and it is drained. The VM's driver should Abandon the
+// channel once the VM stops reading it
+template <typename Cell, size_t Capacity>
+struct BlockingChannelInput {
+    Channel<Cell, Capacity>* channel;
+    bool operator()(Cell& value) {
+        while (!channel->TryPop(value)) {
+            if (channel->Closed()) {
+                return channel->TryPop(value);
+            }
+            std::this_thread::yield();
+        }
+        return true;
+    }
+};
+
+// Waits for room the same way, and gives up with kOutput once the consumer has abandoned the channel, as
+// nothing will ever make room. The VM's driver should Close the channel once the VM stops writing to it
+template <typename Cell, size_t Capacity>
+struct BlockingChannelOutput {
+    Channel<Cell, Capacity>* channel;
+    bool operator()(Cell value) {
+        while (!channel->TryPush(value)) {
+            if (channel->Abandoned()) {
+                return false;
+            }
+            std::this_thread::yield();
+        }
+        return true;
+    }
+};
+
+template <typename Cell>
+struct ConsoleInput {
+    bool operator()(Cell& value) {
+        std::cout << "Enter an Integer: ";
+        std::cin >> value;
+        return true;
+    }
+};
+
+template <typename Cell>
+struct ConsoleOutput {
+    void operator()(Cell value) {
+        std::cout << value << "\n";
+    }
+};
+
+// Execution counters for every RunProgram call made on one thread
+struct Profile {
+    static constexpr size_t kMaxPcs = 1 << 20; // Instructions past this are only counted in farPcs
+
+    uint64_t instructions = 0;
+    std::array<uint64_t, kHaltHandler + 1> handlers = {}; // By dispatch slot, so HALT and unknown opcodes share 10
+    std::vector<uint64_t> pcs;
+    uint64_t farPcs = 0;
+    std::array<uint64_t, 3> modes = {}; // Parameters read or written in each mode
+    // pairs[a][b] counts slot b running straight after slot a fell through to it. The hottest pairs are what
+    // FuseInstructions turns into superinstructions
+    std::array<std::array<uint64_t, kHaltHandler + 1>, kHaltHandler + 1> pairs = {};
+    int64_t lastEnd = -1;
+    uint8_t lastHandler = kDecodeHandler;
+
+    // A slice is one RunProgram call, from entry to the interrupt that ends it
+    std::array<uint64_t, 4> interrupts = {};
+    uint64_t sliceNanoseconds = 0;
+    uint64_t maxSliceNanoseconds = 0;
+    uint64_t maxSliceInstructions = 0;
+    std::array<uint64_t, 64> sliceHistogram = {}; // Bucket i counts slices that took [2^i, 2^(i+1)) ns
+
+    template <typename Cell>
+    void Count(Cell pc, const Instruction<Cell>& inst) {
+        instructions++;
+        handlers[inst.handler]++;
+        if (static_cast<int64_t>(pc) == lastEnd) {
+            pairs[lastHandler][inst.handler]++;
+        }
+        lastEnd = static_cast<int64_t>(pc) + inst.length;
+        lastHandler = inst.handler;
+        if (static_cast<std::make_unsigned_t<Cell>>(pc) < kMaxPcs) {
+            if (static_cast<size_t>(pc) >= pcs.size()) {
+                pcs.resize(pc + 1);
+            }
+            pcs[pc]++;
+        } else {
+            farPcs++;
+        }
+        for (int i = 0; i < inst.length - 1; i++) {
+            if (inst.modes[i] < modes.size()) {
+                modes[inst.modes[i]]++;
+            }
+        }
+    }
+
+    void EndSlice(Interrupt reason, std::chrono::steady_clock::time_point start, uint64_t sliceStartInstructions) {
+        const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        interrupts[reason]++;
+        sliceNanoseconds += ns;
+        maxSliceNanoseconds = std::max(maxSliceNanoseconds, ns);
+        maxSliceInstructions = std::max(maxSliceInstructions, instructions - sliceStartInstructions);
+        size_t bucket = 0;
+        while (bucket + 1 < sliceHistogram.size() && (ns >> (bucket + 1))) {
+            bucket++;
+        }
+        sliceHistogram[bucket]++;
+    }
+
+    // One JSON object. Opcodes and pcs that never ran are left out
+    void Write(std::ostream& out) const {
+        static const char* const kOpcodeNames[] = {
+            nullptr, "add", "mult", "input", "output", "jump_if_true", "jump_if_false", "less_than", "equals", "relative_adj", "halt"
+        };
+        static const char* const kModeNames[] = {"position", "immediate", "relative"};
+        static const char* const kInterruptNames[] = {"input", "output", "halt", "break"};
+
+        out << "{\n  \"instructions\": " << instructions << ",\n  \"opcodes\": {";
+        const char* separator = "";
+        for (size_t i = 1; i < handlers.size(); i++) {
+            if (handlers[i]) {
+                out << separator << "\"" << kOpcodeNames[i] << "\": " << handlers[i];
+                separator = ", ";
+            }
+        }
+        out << "},\n  \"modes\": {";
+        for (size_t i = 0; i < modes.size(); i++) {
+            out << (i ? ", " : "") << "\"" << kModeNames[i] << "\": " << modes[i];
+        }
+        out << "},\n  \"pcs\": {";
+        separator = "";
+        for (size_t pc = 0; pc < pcs.size(); pc++) {
+            if (pcs[pc]) {
+                out << separator << "\"" << pc << "\": " << pcs[pc];
+                separator = ", ";
+            }
+        }
+        out << "},\n  \"pairs\": {";
+        separator = "";
+        for (size_t a = 1; a < pairs.size(); a++) {
+            for (size_t b = 1; b < pairs[a].size(); b++) {
+                if (pairs[a][b]) {
+                    out << separator << "\"" << kOpcodeNames[a] << " " << kOpcodeNames[b] << "\": " << pairs[a][b];
+                    separator = ", ";
+                }
+            }
+        }
+        out << "},\n  \"far_pcs\": " << farPcs << ",\n  \"slices\": {\n    \"interrupts\": {";
+        for (size_t i = 0; i < interrupts.size(); i++) {
+            out << (i ? ", " : "") << "\"" << kInterruptNames[i] << "\": " << interrupts[i];
+        }
+        out << "},\n    \"total_ns\": " << sliceNanoseconds
+            << ",\n    \"max_ns\": " << maxSliceNanoseconds
+            << ",\n    \"max_instructions\": " << maxSliceInstructions
+            << ",\n    \"ns_log2_histogram\": [";
+        size_t last = sliceHistogram.size();
+        while (last > 0 && !sliceHistogram[last - 1]) {
+            last--;
+        }
+        for (size_t i = 0; i < last; i++) {
+            out << (i ? ", " : "") << sliceHistogram[i];
+        }
+        out << "]\n  }\n}\n";
+    }
+};
+
+// Each thread profiles the VMs it runs separately, so threaded days don't contend on the counters
+inline Profile& ThreadProfile() {
+    thread_local Profile profile;
+    return profile;
+}
+
+// Writes this thread's profile to path. Fails if the file can't be written or the profiler isn't built in
+inline bool WriteProfile(const std::string& path) {
+    if (!INTCODE_PROFILE) {
+        std::cerr << "profiling needs a -DINTCODE_PROFILE=1 build\n";
+        return false;
+    }
+    std::ofstream file(path);
+    ThreadProfile().Write(file);
+    return file.good();
+}
+
+#if INTCODE_PROFILE
+#define INTCODE_PROFILE_COUNT() profile.Count(pc, *inst)
+#else
+#define INTCODE_PROFILE_COUNT() do {} while (0)
+#endif
+
+// Jumps to the handler for inst. Threaded dispatch gives every handler its own indirect branch
+// so the predictor can learn opcode sequences, the switch funnels them all through one
+#if INTCODE_COMPUTED_GOTO
+#define INTCODE_JUMP()                                      \
+    do {                                                    \
+        if constexpr (dispatch == kThreadedDispatch) {      \
+            goto *kHandlers[inst->handler];                 \
+        } else {                                            \
+            goto dispatch;                                  \
+        }                                                   \
+    } while (0)
+#else
+#define INTCODE_JUMP()                                      \
+    do {                                                    \
+        goto dispatch;                                      \
+    } while (0)
+#endif
+
+// Moves on to the instruction at pc
+#define INTCODE_NEXT()                                      \
+    do {                                                    \
+        inst = Fetch();                                     \
+        INTCODE_JUMP();                                     \
+    } while (0)
+
+template <Dispatch dispatch = kDefaultDispatch, typename Cell, typename Input, typename Output>
+Interrupt RunProgram(Intcode<Cell>& intcode, Input&& input, Output&& output) {
+    static_assert(INTCODE_COMPUTED_GOTO || dispatch == kSwitchDispatch, "Threaded dispatch needs GCC or Clang");
+
+    // Only the program image is cached. Code running out of other pages is decoded every time
+    if (!intcode.decoded || intcode.decoded->size() != intcode.memory.ImageSize()) {
+        intcode.decoded = std::make_shared<std::vector<Instruction<Cell>>>(intcode.memory.ImageSize());
+        intcode.decodedEnd = 0;
+    }
+
+    Memory<Cell>& memory = intcode.memory;
+    Instruction<Cell>* decoded = intcode.decoded->data();
+    const size_t decodedSize = intcode.decoded->size();
+    Cell decodedEnd = intcode.decodedEnd;
+    Cell pc = intcode.pc;
+    Cell relativeBase = intcode.relativeBase;
+    Instruction<Cell> uncached;
+    bool invalidated = false; // Set by store when it drops a cached instruction
+#if INTCODE_PROFILE
+    Profile& profile = ThreadProfile();
+    const auto sliceStart = std::chrono::steady_clock::now();
+    const uint64_t sliceStartInstructions = profile.instructions;
+#endif
+
+    // The decode cache may still be shared with a fork. Take a private copy before the first write to it
+    auto ownDecoded = [&]() {
+        if (intcode.decoded.use_count() > 1) {
+            intcode.decoded = std::make_shared<std::vector<Instruction<Cell>>>(*intcode.decoded);
+            decoded = intcode.decoded->data();
+        }
+    };
+
+    auto Fetch = [&]() -> Instruction<Cell>* {
+        if (static_cast<size_t>(pc) < decodedSize) {
+            return &decoded[pc];
+        }
+        uncached.handler = kDecodeHandler;
+        return &uncached;
+    };
+    Instruction<Cell>* inst = Fetch();
+    // Starting on a breakpoint means whoever set it is handing this instruction back, so run what is under it.
+    // Breakpoint records aren't kept up to date with memory, so decode it afresh
+    if (inst->handler == kBreakHandler) {
+        uncached = DecodeInstruction(memory, pc);
+        inst = &uncached;
+    }
+
+#if INTCODE_COMPUTED_GOTO
+    static const void* const kHandlers[] = {
+        &&decode, &&add, &&mult, &&input, &&output, &&jumpIfTrue, &&jumpIfFalse, &&lessThan, &&equals, &&relativeAdj, &&halt,
+        &&compareJump, &&adjustJump, &&arithRun, &&breakpoint
+    };
+#endif
+
+    auto load = [&](int i) -> Cell {
+        Cell address;
+        switch (inst->modes[i]) {
+            case IMMEDIATE_MODE:
+                return inst->operands[i];
+            case RELATIVE_MODE:
+                address = relativeBase + inst->operands[i];
+                break;
+            default:
+                address = inst->operands[i];
+                break;
+        }
+        return memory.Load(address);
+    };
+    auto store = [&](int i, Cell value) {
+        Cell address;
+        switch (inst->modes[i]) {
+            case IMMEDIATE_MODE:
+                address = pc + i + 1;
+                break;
+            case RELATIVE_MODE:
+                address = relativeBase + inst->operands[i];
+                break;
+            default:
+                address = inst->operands[i];
+                break;
+        }
+        memory.Store(address, value);
+        if (address < decodedEnd) {
+            // Self-modifying write. Drop every cached instruction that spans this cell. Only fused records reach
+            // back further than one instruction, and cells outside the image have no flags to go by
+            const bool inImage = static_cast<size_t>(address) < decodedSize;
+            const uint8_t flags = inImage ? decoded[address].flags : kCodeFlag | kFusedFlag;
+            if (flags & kCodeFlag) {
+                intcode.rewrites++;
+                const Cell reach = (flags & kFusedFlag) ? kMaxSpan : kMaxLength;
+                const Cell last = std::min<Cell>(address, static_cast<Cell>(decodedSize) - 1);
+                bool dropped = false;
+                for (Cell a = std::max<Cell>(address - (reach - 1), 0); a <= last; a++) {
+                    if (decoded[a].handler != kDecodeHandler && a + decoded[a].span > address) {
+                        ownDecoded();
+                        decoded[a].handler = kDecodeHandler;
+                        decoded[a].flags |= kRewrittenFlag;
+                        dropped = true;
+                    }
+                }
+                // Nothing cached spans the cell now, so writing it again is plain data until it is decoded again
+                if (dropped && inImage) {
+                    decoded[address].flags &= ~(kCodeFlag | kFusedFlag);
+                }
+                invalidated |= dropped;
+            }
+        }
+    };
+    auto interrupt = [&](Interrupt reason) {
+        intcode.pc = pc;
+        intcode.relativeBase = relativeBase;
+        intcode.decodedEnd = decodedEnd;
+#if INTCODE_PROFILE
+        profile.EndSlice(reason, sliceStart, sliceStartInstructions);
+#endif
+        return reason;
+    };
+
+    // Both modes enter through the switch, threaded dispatch then jumps between handlers directly
+    goto dispatch;
+dispatch:
+    switch (inst->handler) {
+        case kDecodeHandler:
+        decode:
+            if (inst != &uncached) {
+                ownDecoded();
+                inst = &decoded[pc];
+                DecodeInto(*inst, memory, pc);
+                for (Cell c = pc; c < pc + inst->length && static_cast<size_t>(c) < decodedSize; c++) {
+                    decoded[c].flags |= kCodeFlag;
+                }
+                decodedEnd = std::max<Cell>(decodedEnd, pc + inst->length);
+                // Rewritten code is decoded over and over and never fused, so it skips the pass
+                if (INTCODE_FUSE && !(inst->flags & kRewrittenFlag)) {
+                    FuseInstructions(decoded, decodedSize, pc);
+                }
+            } else {
+                *inst = DecodeInstruction(memory, pc);
+            }
+            // Fetching again would hand back an undecoded record for code outside the image
+            INTCODE_JUMP();
+        case ADD:
+        add:
+            INTCODE_PROFILE_COUNT();
+            store(2, load(0) + load(1));
+            pc += 4;
+            INTCODE_NEXT();
+        case MULT:
+        mult:
+            INTCODE_PROFILE_COUNT();
+            store(2, load(0) * load(1));
+            pc += 4;
+            INTCODE_NEXT();
+        case INPUT:
+        input: {
+            Cell value;
+            if (!input(value)) {
+                return interrupt(kInput);
+            }
+            // Counted once it completes, an INPUT that interrupts runs again on re-entry
+            INTCODE_PROFILE_COUNT();
+            store(0, value);
+            pc += 2;
+            INTCODE_NEXT();
+        }
+        case OUTPUT:
+        output:
+            if constexpr (std::is_same_v<decltype(output(Cell{})), bool>) {
+                if (!output(load(0))) {
+                    return interrupt(kOutput);
+                }
+            } else {
+                output(load(0));
+            }
+            INTCODE_PROFILE_COUNT();
+            pc += 2;
+            INTCODE_NEXT();
+        case JUMP_IF_TRUE:
+        jumpIfTrue:
+            INTCODE_PROFILE_COUNT();
+            pc = load(0) ? load(1) : pc + 3;
+            INTCODE_NEXT();
+        case JUMP_IF_FALSE:
+        jumpIfFalse:
+            INTCODE_PROFILE_COUNT();
+            pc = !load(0) ? load(1) : pc + 3;
+            INTCODE_NEXT();
+        case LESS_THAN:
+        lessThan:
+            INTCODE_PROFILE_COUNT();
+            store(2, load(0) < load(1));
+            pc += 4;
+            INTCODE_NEXT();
+        case EQUALS:
+        equals:
+            INTCODE_PROFILE_COUNT();
+            store(2, load(0) == load(1));
+            pc += 4;
+            INTCODE_NEXT();
+        case RELATIVE_ADJ:
+        relativeAdj:
+            INTCODE_PROFILE_COUNT();
+            relativeBase += load(0);
+            pc += 2;
+            INTCODE_NEXT();
+        // Fused handlers run their first instruction and then carry on with the cached records after it. If that
+        // first instruction overwrote part of the sequence they fall back to dispatching the rest one by one
+        case kCompareJumpHandler:
+        compareJump: {
+            const Cell a = load(0);
+            const Cell b = load(1);
+            const bool result = (inst->opcode == LESS_THAN) ? a < b : a == b;
+            invalidated = false;
+            store(2, result);
+            pc += 4;
+            if (invalidated) {
+                INTCODE_NEXT();
+            }
+            inst = &decoded[pc];
+            pc = (result == (inst->opcode == JUMP_IF_TRUE)) ? load(1) : pc + 3;
+            INTCODE_NEXT();
+        }
+        case kAdjustJumpHandler:
+        adjustJump:
+            relativeBase += load(0);
+            pc += 2;
+            inst = &decoded[pc];
+            pc = ((load(0) != 0) == (inst->opcode == JUMP_IF_TRUE)) ? load(1) : pc + 3;
+            INTCODE_NEXT();
+        case kArithRunHandler:
+        arithRun: {
+            const Cell end = pc + inst->span;
+            invalidated = false;
+            while (true) {
+                store(2, (inst->opcode == ADD) ? load(0) + load(1) : load(0) * load(1));
+                pc += 4;
+                if (pc == end || invalidated) {
+                    break;
+                }
+                inst = &decoded[pc];
+            }
+            INTCODE_NEXT();
+        }
+        case kBreakHandler:
+        breakpoint:
+            return interrupt(kBreak);
+        case kHaltHandler:
+        default:
+        halt:
+            INTCODE_PROFILE_COUNT();
+            return interrupt(kHalt);
+    }
+}
+
+#undef INTCODE_JUMP
+#undef INTCODE_NEXT
+#undef INTCODE_PROFILE_COUNT
+
+template <typename Cell, size_t InCapacity, size_t OutCapacity>
+Interrupt RunProgram(Intcode<Cell>& intcode, Channel<Cell, InCapacity>* inputs, Channel<Cell, OutCapacity>* outputs) {
+    return RunProgram(intcode, ChannelInput<Cell, InCapacity>{inputs}, ChannelOutput<Cell, OutCapacity>{outputs});
+}
+
+// A null queue falls back to the console, same as the old per-day interpreters
+template <typename Cell>
+Interrupt RunProgram(Intcode<Cell>& intcode, std::deque<Cell>* inputs = nullptr, std::deque<Cell>* outputs = nullptr) {
+    if (inputs && outputs) {
+        return RunProgram(intcode, DequeInput<Cell>{inputs}, DequeOutput<Cell>{outputs});
+    } else if (inputs) {
+        return RunProgram(intcode, DequeInput<Cell>{inputs}, ConsoleOutput<Cell>{});
+    } else if (outputs) {
+        return RunProgram(intcode, ConsoleInput<Cell>{}, DequeOutput<Cell>{outputs});
+    }
+    return RunProgram(intcode, ConsoleInput<Cell>{}, ConsoleOutput<Cell>{});
+}
+
+template <typename Cell>
+std::vector<Cell> ReadProgram(std::istream& istream) {
+    const std::string text((std::istreambuf_iterator<char>(istream)), std::istreambuf_iterator<char>());
+    return ParseIntegers<Cell>(text.data(), text.data() + text.size());
+}
@@ -0,0 +1,508 @@
+#pragma once
+
+// Runs many copies of one Intcode program side by side, for sweeps that try the same program on lots of inputs
+// (day 2's nouns and verbs, day 7's phase orderings). Memory is struct-of-arrays: row i holds cell i of every
+// lane, so while lanes are at the same pc an instruction is decoded once and carried out for all of them with a
+// few vector operations. Each step takes the lanes at the lowest pc. They step together if they agree on the
+// opcode, every address they touch is inside the rows and, for INPUT, all of them have a value waiting.
+// Otherwise they step one at a time over the same rows until they line up again. A lane that reaches outside the
+// rows is handed to an Intcode of its own and finishes in RunProgram, so the rows never grow.
+// Rows known to hold the same value in every lane are flagged, so the common case of every lane running the same
+// code on the same addresses is checked with a lookup rather than a comparison across lanes.
+// The lane loops are written for the compiler to vectorize. Gathers are spelled out with AVX2 intrinsics in
+// builds that have it (-mavx2 or -march=native), everything else runs the same loops.
+
+#include "intcode.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include <array>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+// Lanes defaults to one AVX2 register's worth of cells
+template <typename Cell, size_t Lanes = 32 / sizeof(Cell)>
+class Batch {
+  public:
+    static_assert(Lanes > 0 && Lanes <= 32, "Lane masks are 32 bits");
+    static constexpr size_t kLanes = Lanes;
+    using Row = std::array<Cell, Lanes>;
+    using LaneMask = uint32_t;
+    static constexpr LaneMask kAllLanes = (Lanes == 32) ? ~LaneMask{0} : (LaneMask{1} << Lanes) - 1;
+
+    uint64_t lockstepSteps = 0; // Instructions run for several lanes at once
+    uint64_t laneSteps = 0;     // Instructions run for one lane on its own, not counting lanes handed to RunProgram
+
+    // count copies of program's image, pc and relative base. Lanes past count start out halted
+    explicit Batch(const Intcode<Cell>& program, size_t count = Lanes) {
+        const std::vector<Cell> image = program.memory.Image();
+        rows_.resize(image.size());
+        for (size_t i = 0; i < image.size(); i++) {
+            rows_[i].fill(image[i]);
+        }
+        decoded_.resize(image.size());
+        uniform_.assign(image.size(), true);
+        pc_.fill(program.pc);
+        relativeBase_.fill(program.relativeBase);
+        halted_ = kAllLanes & ~((count >= Lanes) ? kAllLanes : (LaneMask{1} << count) - 1);
+    }
+
+    // One lane's memory, to set up a trial before running it or read its results after
+    Cell& At(size_t lane, Cell address) {
+        if (!scalar_[lane] && !InRows(address)) {
+            Eject(lane);
+        }
+        if (scalar_[lane]) {
+            return scalar_[lane]->memory[address];
+        }
+        uniform_[address] = false;
+        return rows_[address][lane];
+    }
+    Cell Load(size_t lane, Cell address) const {
+        if (scalar_[lane]) {
+            return scalar_[lane]->memory.Load(address);
+        }
+        return InRows(address) ? rows_[address][lane] : 0;
+    }
+
+    std::deque<Cell>& Inputs(size_t lane) { return inputs_[lane]; }
+    std::deque<Cell>& Outputs(size_t lane) { return outputs_[lane]; }
+    bool Halted(size_t lane) const { return (halted_ >> lane) & 1; }
+
+    // Runs every lane until it halts or waits on an empty input queue. kHalt once every lane has halted
+    Interrupt Run() {
+        for (size_t lane = 0; lane < Lanes; lane++) {
+            if (scalar_[lane] && !Halted(lane)) {
+                RunScalar(lane);
+            }
+        }
+        running_ = Live();
+        while (running_) {
+            // Lanes at the lowest pc go first, so lanes that went separate ways at a branch meet again where the
+            // paths join
+            const Row running = Select(running_);
+            Cell pc = std::numeric_limits<Cell>::max();
+            for (size_t lane = 0; lane < Lanes; lane++) {
+                pc = std::min(pc, (pc_[lane] & running[lane]) | (std::numeric_limits<Cell>::max() & ~running[lane]));
+            }
+            LaneMask group = 0;
+            for (size_t lane = 0; lane < Lanes; lane++) {
+                group |= static_cast<LaneMask>(pc_[lane] == pc) << lane;
+            }
+            group &= running_;
+            if ((group & (group - 1)) != 0 && RunLockstep(pc, group)) {
+                continue;
+            }
+            for (size_t lane = 0; lane < Lanes; lane++) {
+                if (InMask(group, lane)) {
+                    StepLane(lane);
+                    laneSteps++;
+                }
+            }
+        }
+        return (halted_ == kAllLanes) ? kHalt : kInput;
+    }
+
+  private:
+    using Address = std::make_unsigned_t<Cell>;
+
+    // An opcode's decoding, kept for as long as the cell still holds that opcode in the lane that looks it up
+    struct Decoded {
+        Cell opcode = 0;
+        Instruction<Cell> inst; // Operands are never filled in, they differ from lane to lane
+    };
+
+    static bool InMask(LaneMask mask, size_t lane) { return (mask >> lane) & 1; }
+
+    static size_t FirstLane(LaneMask mask) {
+        size_t lane = 0;
+        while (!InMask(mask, lane)) {
+            lane++;
+        }
+        return lane;
+    }
+
+    // All ones in the lanes of mask and zero elsewhere, so rows can be merged without branching per lane
+    static Row Select(LaneMask mask) {
+        Row select;
+        for (size_t lane = 0; lane < Lanes; lane++) {
+            select[lane] = -static_cast<Cell>((mask >> lane) & 1);
+        }
+        return select;
+    }
+
+    // values in the lanes of select, row's own cells elsewhere
+    static void Blend(Row& row, const Row& values, const Row& select) {
+        for (size_t lane = 0; lane < Lanes; lane++) {
+            row[lane] = (values[lane] & select[lane]) | (row[lane] & ~select[lane]);
+        }
+    }
+
+    // Whether every lane of mask holds value
+    static bool AllEqual(const Row& row, Cell value, LaneMask mask) {
+        LaneMask differ = 0;
+        for (size_t lane = 0; lane < Lanes; lane++) {
+            differ |= static_cast<LaneMask>(row[lane] != value) << lane;
+        }
+        return (differ & mask) == 0;
+    }
+
+    // Lanes that may run again. Halted and ejected lanes no longer read the rows, so they can disagree with the
+    // rest without making a row non-uniform
+    LaneMask Live() const { return kAllLanes & ~halted_ & ~ejected_; }
+
+    bool InRows(Cell address) const { return static_cast<Address>(address) < rows_.size(); }
+
+    bool AllInRows(const Row& addresses, LaneMask mask) const {
+        LaneMask outside = 0;
+        for (size_t lane = 0; lane < Lanes; lane++) {
+            outside |= static_cast<LaneMask>(static_cast<Address>(addresses[lane]) >= rows_.size()) << lane;
+        }
+        return (outside & mask) == 0;
+    }
+
+    const Instruction<Cell>& Decode(Cell pc, Cell opcode) {
+        Decoded& d = decoded_[pc];
+        if (d.inst.length == 0 || d.opcode != opcode) {
+            d.opcode = opcode;
+            d.inst = DecodeOpcode(opcode);
+        }
+        return d.inst;
+    }
+
+    // Where one operand of an instruction points for each lane of a group
+    struct Operand {
+        bool uniform;   // Every lane of the group uses address
+        Cell address;
+        Row addresses;  // Filled in when they don't
+    };
+
+    // Operand i of the instruction at pc for the lanes of group. first is one of them. False if any of them points
+    // outside the rows. Immediate operands are read from, and written to, the operand's own cell
+    bool Resolve(Cell pc, int i, uint8_t mode, LaneMask group, size_t first, Operand& operand) const {
+        const Cell cell = pc + i + 1;
+        const Row& operands = rows_[cell];
+        if (mode == IMMEDIATE_MODE) {
+            operand.uniform = true;
+            operand.address = cell;
+        } else if (mode == RELATIVE_MODE) {
+            if (uniform_[cell] && relativeBaseUniform_) {
+                operand.uniform = true;
+                operand.address = relativeBase_[first] + operands[first];
+            } else {
+                for (size_t lane = 0; lane < Lanes; lane++) {
+                    operand.addresses[lane] = relativeBase_[lane] + operands[lane];
+                }
+                operand.address = operand.addresses[first];
+                operand.uniform = AllEqual(operand.addresses, operand.address, group);
+            }
+        } else {
+            operand.address = operands[first];
+            operand.uniform = uniform_[cell] || AllEqual(operands, operand.address, group);
+            if (!operand.uniform) {
+                operand.addresses = operands;
+            }
+        }
+        return operand.uniform ? InRows(operand.address) : AllInRows(operand.addresses, group);
+    }
+
+    // The cell each lane of select's operand points at. Lanes outside select get something from the rows
+    Row Load(const Operand& operand, const Row& select) const {
+        if (operand.uniform) {
+            return rows_[operand.address];
+        }
+        Row index;
+        for (size_t lane = 0; lane < Lanes; lane++) {
+            const Cell address = (operand.addresses[lane] & select[lane]) | (operand.address & ~select[lane]);
+            index[lane] = address * static_cast<Cell>(Lanes) + static_cast<Cell>(lane);
+        }
+        Row values;
+#if defined(__AVX2__)
+        if constexpr (sizeof(Cell) == 4 && Lanes == 8) {
+            const __m256i i = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index.data()));
+            const __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(rows_.data()), i, 4);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(values.data()), v);
+            return values;
+        } else if constexpr (sizeof(Cell) == 8 && Lanes == 4) {
+            const __m256i i = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index.data()));
+            const __m256i v = _mm256_i64gather_epi64(reinterpret_cast<const long long*>(rows_.data()), i, 8);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(values.data()), v);
+            return values;
+        }
+#endif
+        for (size_t lane = 0; lane < Lanes; lane++) {
+            values[lane] = rows_[index[lane] / static_cast<Cell>(Lanes)][lane];
+        }
+        return values;
+    }
+
+    // Writes each lane of group's value to where its operand points
+    void Store(const Operand& operand, LaneMask group, size_t first, const Row& select, const Row& values) {
+        if (operand.uniform) {
+            Row& row = rows_[operand.address];
+            Blend(row, values, select);
+            uniform_[operand.address] = AllEqual(row, row[first], Live());
+            return;
+        }
+        for (size_t lane = 0; lane < Lanes; lane++) {
+            if (InMask(group, lane)) {
+                rows_[operand.addresses[lane]][lane] = values[lane];
+                uniform_[operand.addresses[lane]] = false;
+            }
+        }
+    }
+
+    // Runs group, which are all at pc, for as long as they stay together. False if the very first instruction has
+    // to go lane by lane
+    bool RunLockstep(Cell pc, LaneMask group) {
+        const size_t first = FirstLane(group);
+        const Row select = Select(group);
+        const uint64_t start = lockstepSteps;
+        bool waiting = false;
+        Operand operands[3];
+        while (InRows(pc)) {
+            const Cell opcode = rows_[pc][first];
+            if (!uniform_[pc] && !AllEqual(rows_[pc], opcode, group)) {
+                break;
+            }
+            const Instruction<Cell>& inst = Decode(pc, opcode);
+            if (inst.handler == kHaltHandler) {
+                lockstepSteps++;
+                halted_ |= group;
+                running_ &= ~group;
+                break;
+            }
+            if (!InRows(pc + inst.length - 1)) {
+                break;
+            }
+            bool inside = true;
+            for (int i = 0; inside && i < inst.length - 1; i++) {
+                inside = Resolve(pc, i, inst.modes[i], group, first, operands[i]);
+            }
+            if (!inside) {
+                break;
+            }
+
+            if (inst.handler == INPUT) {
+                // Together when every lane has a value waiting or none of them do. Otherwise the lanes find out on
+                // their own
+                Row values = {};
+                LaneMask empty = 0;
+                for (size_t lane = 0; lane < Lanes; lane++) {
+                    empty |= static_cast<LaneMask>(InMask(group, lane) && inputs_[lane].empty()) << lane;
+                }
+                if (empty == group) {
+                    running_ &= ~group;
+                    waiting = true;
+                    break;
+                } else if (empty) {
+                    break;
+                }
+                for (size_t lane = 0; lane < Lanes; lane++) {
+                    if (InMask(group, lane)) {
+                        values[lane] = inputs_[lane].front();
+                        inputs_[lane].pop_front();
+                    }
+                }
+                lockstepSteps++;
+                Store(operands[0], group, first, select, values);
+                pc += 2;
+                continue;
+            }
+
+            lockstepSteps++;
+            const Row a = Load(operands[0], select);
+            if (inst.handler == OUTPUT) {
+                for (size_t lane = 0; lane < Lanes; lane++) {
+                    if (InMask(group, lane)) {
+                        outputs_[lane].push_back(a[lane]);
+                    }
+                }
+                pc += 2;
+                continue;
+            }
+            if (inst.handler == RELATIVE_ADJ) {
+                for (size_t lane = 0; lane < Lanes; lane++) {
+                    relativeBase_[lane] += a[lane] & select[lane];
+                }
+                relativeBaseUniform_ = AllEqual(relativeBase_, relativeBase_[first], Live());
+                pc += 2;
+                continue;
+            }
+            const Row b = Load(operands[1], select);
+            if (inst.handler == JUMP_IF_TRUE || inst.handler == JUMP_IF_FALSE) {
+                // All ones in the lanes that jump
+                const Cell ifTrue = (inst.handler == JUMP_IF_TRUE) ? 0 : -1;
+                Row taken, next;
+                for (size_t lane = 0; lane < Lanes; lane++) {
+                    taken[lane] = -static_cast<Cell>(a[lane] != 0) ^ ifTrue;
+                    next[lane] = (b[lane] & taken[lane]) | ((pc + 3) & ~taken[lane]);
+                }
+                if (!AllEqual(next, next[first], group)) {
+                    // The group splits up here
+                    Blend(pc_, next, select);
+                    return true;
+                }
+                pc = next[first];
+                continue;
+            }
+            Row result;
+            switch (inst.handler) {
+                case ADD:
+                    for (size_t lane = 0; lane < Lanes; lane++) {
+                        result[lane] = a[lane] + b[lane];
+                    }
+                    break;
+                case MULT:
+                    for (size_t lane = 0; lane < Lanes; lane++) {
+                        result[lane] = a[lane] * b[lane];
+                    }
+                    break;
+                case LESS_THAN:
+                    for (size_t lane = 0; lane < Lanes; lane++) {
+                        result[lane] = a[lane] < b[lane];
+                    }
+                    break;
+                default:
+                    for (size_t lane = 0; lane < Lanes; lane++) {
+                        result[lane] = a[lane] == b[lane];
+                    }
+                    break;
+            }
+            Store(operands[2], group, first, select, result);
+            pc += 4;
+        }
+        Row at;
+        at.fill(pc);
+        Blend(pc_, at, select);
+        return lockstepSteps != start || waiting;
+    }
+
+    // One instruction for one lane. If it would reach outside the rows the lane is ejected before it has had any
+    // effect and RunProgram carries on from it
+    void StepLane(size_t lane) {
+        const LaneMask bit = LaneMask{1} << lane;
+        const Cell pc = pc_[lane];
+        if (!InRows(pc)) {
+            Eject(lane);
+            RunScalar(lane);
+            return;
+        }
+        const Instruction<Cell>& inst = Decode(pc, rows_[pc][lane]);
+        Cell addresses[3] = {};
+        bool inside = InRows(pc + inst.length - 1);
+        for (int i = 0; inside && i < inst.length - 1; i++) {
+            const Cell cell = pc + i + 1;
+            switch (inst.modes[i]) {
+                case IMMEDIATE_MODE:
+                    addresses[i] = cell;
+                    break;
+                case RELATIVE_MODE:
+                    addresses[i] = relativeBase_[lane] + rows_[cell][lane];
+                    break;
+                default:
+                    addresses[i] = rows_[cell][lane];
+                    break;
+            }
+            inside = InRows(addresses[i]);
+        }
+        if (!inside) {
+            Eject(lane);
+            RunScalar(lane);
+            return;
+        }
+
+        auto load = [&](int i) { return rows_[addresses[i]][lane]; };
+        auto store = [&](int i, Cell value) {
+            rows_[addresses[i]][lane] = value;
+            uniform_[addresses[i]] = false;
+        };
+        switch (inst.handler) {
+            case ADD:
+                store(2, load(0) + load(1));
+                pc_[lane] = pc + 4;
+                break;
+            case MULT:
+                store(2, load(0) * load(1));
+                pc_[lane] = pc + 4;
+                break;
+            case INPUT:
+                if (inputs_[lane].empty()) {
+                    running_ &= ~bit;
+                    break;
+                }
+                store(0, inputs_[lane].front());
+                inputs_[lane].pop_front();
+                pc_[lane] = pc + 2;
+                break;
+            case OUTPUT:
+                outputs_[lane].push_back(load(0));
+                pc_[lane] = pc + 2;
+                break;
+            case JUMP_IF_TRUE:
+                pc_[lane] = load(0) ? load(1) : pc + 3;
+                break;
+            case JUMP_IF_FALSE:
+                pc_[lane] = !load(0) ? load(1) : pc + 3;
+                break;
+            case LESS_THAN:
+                store(2, load(0) < load(1));
+                pc_[lane] = pc + 4;
+                break;
+            case EQUALS:
+                store(2, load(0) == load(1));
+                pc_[lane] = pc + 4;
+                break;
+            case RELATIVE_ADJ:
+                relativeBase_[lane] += load(0);
+                relativeBaseUniform_ = false;
+                pc_[lane] = pc + 2;
+                break;
+            default:
+                running_ &= ~bit;
+                halted_ |= bit;
+                break;
+        }
+    }
+
+    // Moves a lane out of the rows into an Intcode of its own
+    void Eject(size_t lane) {
+        std::vector<Cell> image(rows_.size());
+        for (size_t i = 0; i < rows_.size(); i++) {
+            image[i] = rows_[i][lane];
+        }
+        scalar_[lane] = std::make_unique<Intcode<Cell>>();
+        scalar_[lane]->memory = image;
+        scalar_[lane]->pc = pc_[lane];
+        scalar_[lane]->relativeBase = relativeBase_[lane];
+        running_ &= ~(LaneMask{1} << lane);
+        ejected_ |= LaneMask{1} << lane;
+    }
+
+    void RunScalar(size_t lane) {
+        if (RunProgram(*scalar_[lane], &inputs_[lane], &outputs_[lane]) == kHalt) {
+            halted_ |= LaneMask{1} << lane;
+        }
+    }
+
+    std::vector<Row> rows_;
+    std::vector<Decoded> decoded_;
+    std::vector<uint8_t> uniform_; // Set when every live lane is known to hold the same value in the row
+    Row pc_;                       // Only kept up to date for the lanes of a lockstep group once it breaks up
+    Row relativeBase_;
+    bool relativeBaseUniform_ = true;
+    LaneMask running_ = 0; // Lanes still to step in this Run
+    LaneMask halted_ = 0;
+    LaneMask ejected_ = 0;
+    std::array<std::deque<Cell>, Lanes> inputs_;
+    std::array<std::deque<Cell>, Lanes> outputs_;
+    std::array<std::unique_ptr<Intcode<Cell>>, Lanes> scalar_;
+};
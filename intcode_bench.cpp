@@ -0,0 +1,211 @@
+
+#include "clue.h"
+#include "intcode.h"
+#include "intcode_batch.h"
+#include "intcode_image.h"
+#include "intcode_jit.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+#if INTCODE_COMPUTED_GOTO
+constexpr Dispatch kThreaded = kThreadedDispatch;
+#else
+constexpr Dispatch kThreaded = kSwitchDispatch;
+#endif
+
+template <typename Cell = int64_t>
+std::optional<Intcode<Cell>> LoadProgram(const std::string& path) {
+    std::optional<Memory<Cell>> memory = OpenProgram<Cell>(path);
+    if (!memory) {
+        return {};
+    }
+    Intcode<Cell> intcode;
+    intcode.memory = std::move(*memory);
+    return intcode;
+}
+
+// Interpreter only, or with compiled code when jit is set. Compiling is part of what gets timed
+template <Dispatch dispatch, bool jit = false>
+struct Runner {
+#if INTCODE_JIT
+    Jit compiled;
+#endif
+    template <typename Input, typename Output>
+    Interrupt operator()(Intcode<int64_t>& intcode, Input&& input, Output&& output) {
+#if INTCODE_JIT
+        if (jit) {
+            return RunJit(intcode, compiled, input, output);
+        }
+#endif
+        return RunProgram<dispatch>(intcode, input, output);
+    }
+};
+
+// Day 9 part 2
+template <Dispatch dispatch, bool jit = false>
+int64_t Boost(const Intcode<int64_t>& program) {
+    Intcode<int64_t> intcode = program;
+    Runner<dispatch, jit> run;
+    std::deque<int64_t> inputs = {2};
+    std::deque<int64_t> outputs;
+    run(intcode, DequeInput<int64_t>{&inputs}, DequeOutput<int64_t>{&outputs});
+    return outputs.back();
+}
+
+// Day 13 part 2 without the screen. Follows the ball with the paddle and returns the final score
+template <Dispatch dispatch, bool jit = false>
+int64_t PlayArcade(const Intcode<int64_t>& program) {
+    Intcode<int64_t> intcode = program;
+    Runner<dispatch, jit> run;
+    intcode.memory[0] = 2;
+    std::deque<int64_t> inputs;
+    std::deque<int64_t> outputs;
+    int64_t score = 0;
+    int64_t ballX = 0;
+    int64_t paddleX = 0;
+    while (true) {
+        Interrupt interrupt = run(intcode, DequeInput<int64_t>{&inputs}, DequeOutput<int64_t>{&outputs});
+        while (!outputs.empty()) {
+            int64_t x = outputs.front(); outputs.pop_front();
+            int64_t y = outputs.front(); outputs.pop_front();
+            int64_t tileId = outputs.front(); outputs.pop_front();
+            if (x == -1 && y == 0) {
+                score = tileId;
+            } else if (tileId == 3) {
+                paddleX = x;
+            } else if (tileId == 4) {
+                ballX = x;
+            }
+        }
+        if (interrupt == kHalt) break;
+        inputs.push_back((ballX > paddleX) - (ballX < paddleX));
+    }
+    return score;
+}
+
+// Day 2 part 2 without stopping at the answer. Runs every noun and verb and returns how many of them hit the target
+constexpr int kDay2Target = 19690720;
+
+int64_t Sweep(const Intcode<int>& program) {
+    Intcode<int> scratch;
+    int64_t hits = 0;
+    for (int noun = 0; noun <= 99; noun++) {
+        for (int verb = 0; verb <= 99; verb++) {
+            Restore(scratch, program);
+            scratch.memory[1] = noun;
+            scratch.memory[2] = verb;
+            RunProgram(scratch);
+            hits += scratch.memory.Load(0) == kDay2Target;
+        }
+    }
+    return hits;
+}
+
+int64_t BatchSweep(const Intcode<int>& program) {
+    constexpr size_t kLanes = Batch<int>::kLanes;
+    int64_t hits = 0;
+    for (size_t first = 0; first < 100 * 100; first += kLanes) {
+        const size_t count = std::min<size_t>(kLanes, 100 * 100 - first);
+        Batch<int> batch(program, count);
+        for (size_t lane = 0; lane < count; lane++) {
+            batch.At(lane, 1) = static_cast<int>((first + lane) / 100);
+            batch.At(lane, 2) = static_cast<int>((first + lane) % 100);
+        }
+        batch.Run();
+        for (size_t lane = 0; lane < count; lane++) {
+            hits += batch.Load(lane, 0) == kDay2Target;
+        }
+    }
+    return hits;
+}
+
+template <typename F>
+double MillisecondsPerRun(int iterations, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        f();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+template <typename Switch, typename Threaded, typename Compiled>
+void Compare(const char* name, int iterations, Switch&& switchRun, Threaded&& threadedRun, Compiled&& jitRun) {
+    printf("%s: %lld\n", name, static_cast<long long>(switchRun()));
+    double switchMs = MillisecondsPerRun(iterations, switchRun);
+    printf("  switch:   %8.3f ms\n", switchMs);
+#if INTCODE_COMPUTED_GOTO
+    if (threadedRun() != switchRun()) {
+        printf("  threaded dispatch disagrees with switch dispatch\n");
+        std::exit(1);
+    }
+    double threadedMs = MillisecondsPerRun(iterations, threadedRun);
+    printf("  threaded: %8.3f ms (%.2fx)\n", threadedMs, switchMs / threadedMs);
+#else
+    (void)threadedRun;
+    printf("  threaded: unavailable, compiler has no labels-as-values\n");
+#endif
+#if INTCODE_JIT
+    if (jitRun() != switchRun()) {
+        printf("  jit disagrees with switch dispatch\n");
+        std::exit(1);
+    }
+    double jitMs = MillisecondsPerRun(iterations, jitRun);
+    printf("  jit:      %8.3f ms (%.2fx)\n", jitMs, switchMs / jitMs);
+#else
+    (void)jitRun;
+    printf("  jit:      unavailable, needs x86-64 Linux or macOS\n");
+#endif
+}
+
+template <typename Scalar, typename Batched>
+void CompareBatch(const char* name, int iterations, Scalar&& scalarRun, Batched&& batchRun) {
+    printf("%s: %lld\n", name, static_cast<long long>(scalarRun()));
+    if (batchRun() != scalarRun()) {
+        printf("  batch disagrees with one VM at a time\n");
+        std::exit(1);
+    }
+    double scalarMs = MillisecondsPerRun(iterations, scalarRun);
+    printf("  scalar:   %8.3f ms\n", scalarMs);
+    double batchMs = MillisecondsPerRun(iterations, batchRun);
+    printf("  batch:    %8.3f ms (%.2fx)\n", batchMs, scalarMs / batchMs);
+}
+
+struct Args {
+    std::string day2 = "day2.txt";
+    std::string day9 = "day9.txt";
+    std::string day13 = "day13.txt";
+    int iterations = 20;
+};
+
+int main(int argc, char** argv) {
+    clue::CommandLine<Args> cl;
+    cl.Optional(&Args::day2, "day2");
+    cl.Optional(&Args::day9, "day9");
+    cl.Optional(&Args::day13, "day13");
+    cl.Optional(&Args::iterations, "iterations");
+    auto args = cl.ParseArgs(argc, argv);
+
+    // Every program is loaded before anything is timed, so a missing one stops the run straight away
+    std::optional<Intcode<int64_t>> boost = LoadProgram(args->day9);
+    std::optional<Intcode<int64_t>> arcade = LoadProgram(args->day13);
+    std::optional<Intcode<int>> gravityAssist = LoadProgram<int>(args->day2);
+    if (!boost || !arcade || !gravityAssist) {
+        return 1;
+    }
+
+    Compare("day9 BOOST", args->iterations,
+        [&]() { return Boost<kSwitchDispatch>(*boost); },
+        [&]() { return Boost<kThreaded>(*boost); },
+        [&]() { return Boost<kThreaded, true>(*boost); });
+
+    Compare("day13 headless", args->iterations,
+        [&]() { return PlayArcade<kSwitchDispatch>(*arcade); },
+        [&]() { return PlayArcade<kThreaded>(*arcade); },
+        [&]() { return PlayArcade<kThreaded, true>(*arcade); });
+
+    CompareBatch("day2 sweep", args->iterations,
+        [&]() { return Sweep(*gravityAssist); },
+        [&]() { return BatchSweep(*gravityAssist); });
+}
@@ -0,0 +1,103 @@
+#include "clue.h"
+#include "intcode.h"
+#include "intcode_cfg.h"
+#include "intcode_image.h"
+#include <fstream>
+#include <iostream>
+
+// Which cells of an Intcode program are code and which are data, its basic blocks and its self-modifying writes
+struct Args {
+    std::string program;
+    std::string dot = ""; // Write the control flow graph here, for Graphviz
+    bool blocks = false; // List every basic block with its instructions
+};
+
+template <typename Cell>
+void WriteDot(std::ostream& out, const Memory<Cell>& memory, const ControlFlow<Cell>& flow) {
+    out << "digraph intcode {\n";
+    out << "    node [shape=box, fontname=\"monospace\"];\n";
+    for (const auto& [begin, block] : flow.blocks) {
+        out << "    b" << begin << " [label=\"";
+        for (Cell pc = begin; pc < block.end;) {
+            const Instruction<Cell> inst = DecodeInstruction(memory, pc);
+            out << pc << ": " << Disassemble(inst) << "\\l";
+            pc += inst.length;
+        }
+        out << "\"];\n";
+        for (Cell successor : block.successors) {
+            if (!flow.blocks.count(successor)) {
+                out << "    b" << successor << " [shape=plaintext, label=\"" << successor << " (off the image)\"];\n";
+            }
+            out << "    b" << begin << " -> b" << successor << ";\n";
+        }
+        if (block.computed) {
+            out << "    b" << begin << " -> computed [style=dashed];\n";
+        }
+    }
+    // One node stands for every computed jump, with an edge to everywhere they're assumed to go
+    out << "    computed [shape=diamond];\n";
+    for (Cell target : flow.computedTargets) {
+        out << "    computed -> b" << target << " [style=dashed];\n";
+    }
+    out << "}\n";
+}
+
+int main(int argc, char** argv) {
+    clue::CommandLine<Args> cl;
+    cl.Optional(&Args::dot, "dot");
+    cl.Optional(&Args::blocks, "blocks");
+    cl.Positional(&Args::program, "program", "Program or image to analyze", clue::kRequired);
+    auto args = cl.ParseArgs(argc, argv);
+
+    std::optional<Memory<int64_t>> memory = OpenProgram<int64_t>(args->program);
+    if (!memory) {
+        return 1;
+    }
+    const ControlFlow<int64_t> flow = RecoverControlFlow(*memory);
+
+    const size_t code = std::count(flow.code.begin(), flow.code.end(), true);
+    printf("%zu cells: %zu code, %zu data\n", flow.code.size(), code, flow.code.size() - code);
+    size_t computed = 0;
+    for (const auto& [begin, block] : flow.blocks) {
+        computed += block.computed;
+    }
+    printf("%zu basic blocks, %zu ending in computed jumps to any of %zu targets\n", flow.blocks.size(), computed, flow.computedTargets.size());
+    if (flow.selfModifying.empty()) {
+        printf("no position mode writes to code\n");
+    }
+    for (const auto& [cell, writers] : flow.selfModifying) {
+        printf("code cell %lld written by", static_cast<long long>(cell));
+        for (int64_t pc : writers) {
+            printf(" %lld", static_cast<long long>(pc));
+        }
+        printf("\n");
+    }
+    printf("%zu relative mode writes could land anywhere, code included\n", flow.relativeWrites.size());
+    for (int64_t pc : flow.invalid) {
+        printf("reachable %lld is not a valid instruction\n", static_cast<long long>(pc));
+    }
+
+    if (args->blocks) {
+        for (const auto& [begin, block] : flow.blocks) {
+            printf("\nblock %lld ->", static_cast<long long>(begin));
+            for (int64_t successor : block.successors) {
+                printf(" %lld", static_cast<long long>(successor));
+            }
+            printf(block.computed ? " computed\n" : "\n");
+            for (int64_t pc = begin; pc < block.end;) {
+                const Instruction<int64_t> inst = DecodeInstruction(*memory, pc);
+                printf("  %5lld  %s\n", static_cast<long long>(pc), Disassemble(inst).c_str());
+                pc += inst.length;
+            }
+        }
+    }
+
+    if (!args->dot.empty()) {
+        std::ofstream file(args->dot);
+        WriteDot(file, *memory, flow);
+        if (!file) {
+            std::cerr << "can't write " << args->dot << "\n";
+            return 1;
+        }
+    }
+}
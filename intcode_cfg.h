@@ -0,0 +1,307 @@
+#pragma once
+
+// Control flow recovery for Intcode images. Follows every path from address 0 to find which cells are executed
+// as code and which are only data, splits the code into basic blocks and finds writes that land on code.
+//
+// Jumps with an immediate target are followed directly. So are position mode targets, as long as nothing the
+// program does could have written the cell they're read from. Every other jump is computed: its target is only
+// known at run time, usually a return address saved on the relative base stack. Computed jumps are assumed to
+// land on an address the program builds from immediates, like the ADD 0, ret that pushes a return address, or on
+// what the image first holds in a position mode target's cell. Every such address inside the image that leads only
+// to valid code is explored as well. Relative mode writes can't be placed, so they're listed rather than checked
+// against the code. Programs that rewrite their own opcodes, like day 5's self test, can run instructions this never
+// sees. selfModifying has the cells where that can happen.
+
+#include "intcode.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+template <typename Cell>
+struct BasicBlock {
+    Cell begin = 0;
+    Cell end = 0; // One past the last cell of the last instruction
+    std::vector<Cell> successors;
+    bool computed = false; // Ends in a jump whose target is only known at run time
+};
+
+template <typename Cell>
+struct ControlFlow {
+    std::vector<bool> code;                         // Image cells that are part of a reachable instruction
+    std::map<Cell, BasicBlock<Cell>> blocks;        // By first address
+    std::set<Cell> computedTargets;                 // Addresses the program builds that computed jumps may reach
+    std::map<Cell, std::set<Cell>> selfModifying;   // Code cells, and the instructions that write to them
+    std::set<Cell> relativeWrites;                  // Instructions writing through the relative base
+    std::set<Cell> invalid;                         // Reachable cells that aren't a valid opcode, or are off the image
+};
+
+// How a jump at pc leaves: where it may go and whether it may fall through
+template <typename Cell>
+struct JumpTargets {
+    bool taken = true;  // Jumps at least some of the time
+    bool falls = true;  // Falls through at least some of the time
+    bool known = false; // The target is target
+    Cell target = 0;
+};
+
+template <typename Cell>
+JumpTargets<Cell> JumpTargetsOf(const Instruction<Cell>& inst, const Memory<Cell>& memory, const std::vector<bool>& written,
+                                bool unplacedWrites) {
+    JumpTargets<Cell> jump;
+    if (inst.modes[0] == IMMEDIATE_MODE) {
+        const bool jumps = (inst.opcode == JUMP_IF_TRUE) == (inst.operands[0] != 0);
+        jump.taken = jumps;
+        jump.falls = !jumps;
+    }
+    const Cell address = inst.operands[1];
+    if (inst.modes[1] == IMMEDIATE_MODE) {
+        jump.known = true;
+        jump.target = address;
+    } else if (inst.modes[1] == POSITION_MODE && !unplacedWrites && address >= 0 &&
+               (static_cast<size_t>(address) >= written.size() || !written[address])) {
+        jump.known = true;
+        jump.target = memory.Load(address);
+    }
+    return jump;
+}
+
+// What a walk over the image has found so far
+template <typename Cell>
+struct Reached {
+    std::vector<bool> starts;  // First cell of a reachable instruction
+    std::vector<bool> code;
+    std::vector<bool> written; // Targets of position mode writes
+    bool unplacedWrites = false;
+    std::set<Cell> constants;  // Built from immediates by a reachable ADD or MULT, or first held by a jump's target cell
+    std::set<Cell> invalid;
+};
+
+// Follows every path from root. With strict set, gives up on the first instruction that is invalid, runs off the
+// image or overlaps one already found, as code doesn't do that and data decoded as code usually does
+template <typename Cell>
+bool Explore(Reached<Cell>& reached, const Memory<Cell>& memory, Cell root, const std::vector<bool>& written, bool unplacedWrites,
+             bool strict) {
+    const size_t size = reached.starts.size();
+    auto inImage = [&](Cell address) { return address >= 0 && static_cast<size_t>(address) < size; };
+    std::vector<Cell> work = {root};
+    while (!work.empty()) {
+        const Cell pc = work.back();
+        work.pop_back();
+        if (!inImage(pc)) {
+            if (strict) {
+                return false;
+            }
+            reached.invalid.insert(pc);
+            continue;
+        }
+        if (reached.starts[pc]) {
+            continue;
+        }
+        const Instruction<Cell> inst = DecodeInstruction(memory, pc);
+        if (strict) {
+            if (reached.code[pc] || (inst.handler == kHaltHandler && inst.opcode != HALT) || !inImage(pc + inst.length - 1)) {
+                return false;
+            }
+            for (Cell c = pc + 1; c < pc + inst.length; c++) {
+                if (reached.starts[c]) {
+                    return false;
+                }
+            }
+        }
+        reached.starts[pc] = true;
+        for (Cell c = pc; c < pc + inst.length && inImage(c); c++) {
+            reached.code[c] = true;
+        }
+        const int writes = (inst.opcode == INPUT) ? 0 : (inst.length == 4) ? 2 : -1;
+        if (writes >= 0) {
+            if (inst.modes[writes] == RELATIVE_MODE) {
+                reached.unplacedWrites = true;
+            } else if (inst.modes[writes] == POSITION_MODE && inImage(inst.operands[writes])) {
+                reached.written[inst.operands[writes]] = true;
+            }
+        }
+        if ((inst.opcode == ADD || inst.opcode == MULT) && inst.modes[0] == IMMEDIATE_MODE && inst.modes[1] == IMMEDIATE_MODE) {
+            reached.constants.insert(inst.opcode == ADD ? inst.operands[0] + inst.operands[1] : inst.operands[0] * inst.operands[1]);
+        }
+        if (inst.handler == kHaltHandler) {
+            if (inst.opcode != HALT) {
+                reached.invalid.insert(pc);
+            }
+            continue;
+        }
+        if (inst.opcode == JUMP_IF_TRUE || inst.opcode == JUMP_IF_FALSE) {
+            const JumpTargets<Cell> jump = JumpTargetsOf(inst, memory, written, unplacedWrites);
+            if (jump.taken && jump.known) {
+                work.push_back(jump.target);
+            } else if (jump.taken && inst.modes[1] == POSITION_MODE && inImage(inst.operands[1])) {
+                // Until something writes the target's cell, it still holds what the image has there
+                reached.constants.insert(memory.Load(inst.operands[1]));
+            }
+            if (!jump.falls) {
+                continue;
+            }
+        }
+        work.push_back(pc + inst.length);
+    }
+    return true;
+}
+
+template <typename Cell>
+ControlFlow<Cell> RecoverControlFlow(const Memory<Cell>& memory) {
+    const size_t size = memory.ImageSize();
+    auto inImage = [&](Cell address) { return address >= 0 && static_cast<size_t>(address) < size; };
+
+    // Which cells get written decides which position mode jumps can be followed, and following them can turn up
+    // more writes. Start by assuming nothing is written and walk again with everything found so far until a walk
+    // finds nothing new. Writes are only ever added, as dropping the ones behind a jump that has just become
+    // computed could bring the jump back and go round forever
+    std::vector<bool> written(size);
+    bool unplacedWrites = false;
+    std::set<Cell> roots;
+    Reached<Cell> reached;
+    while (true) {
+        reached = Reached<Cell>();
+        reached.starts.assign(size, false);
+        reached.code.assign(size, false);
+        reached.written.assign(size, false);
+        roots.clear();
+        Explore(reached, memory, Cell{0}, written, unplacedWrites, false);
+        // Constants that could be code are tried as computed targets, each kept only if everything it leads to is
+        // consistent with the code found so far. Accepting one can add constants, so go round until none are new
+        std::set<Cell> tried;
+        bool grew = true;
+        while (grew) {
+            grew = false;
+            const std::set<Cell> constants = reached.constants;
+            for (Cell target : constants) {
+                if (!inImage(target) || !tried.insert(target).second) {
+                    continue;
+                }
+                if (reached.starts[target]) {
+                    roots.insert(target);
+                    continue;
+                }
+                Reached<Cell> attempt = reached;
+                if (Explore(attempt, memory, target, written, unplacedWrites, true)) {
+                    reached = std::move(attempt);
+                    roots.insert(target);
+                    grew = true;
+                }
+            }
+        }
+        bool grown = reached.unplacedWrites && !unplacedWrites;
+        for (size_t cell = 0; cell < size; cell++) {
+            if (reached.written[cell] && !written[cell]) {
+                written[cell] = true;
+                grown = true;
+            }
+        }
+        unplacedWrites = unplacedWrites || reached.unplacedWrites;
+        if (!grown) {
+            break;
+        }
+    }
+    const std::vector<bool>& starts = reached.starts;
+    ControlFlow<Cell> flow;
+    flow.code = reached.code;
+    flow.invalid = reached.invalid;
+    flow.computedTargets = roots;
+
+    // A block starts at the entry, a jump target, a computed target or after a jump, and ends at a jump, a halt
+    // or the next block's start
+    std::set<Cell> leaders = roots;
+    leaders.insert(0);
+    for (size_t pc = 0; pc < size; pc++) {
+        if (!starts[pc]) {
+            continue;
+        }
+        const Instruction<Cell> inst = DecodeInstruction(memory, static_cast<Cell>(pc));
+        if (inst.opcode == JUMP_IF_TRUE || inst.opcode == JUMP_IF_FALSE) {
+            const JumpTargets<Cell> jump = JumpTargetsOf(inst, memory, written, unplacedWrites);
+            if (jump.known && inImage(jump.target)) {
+                leaders.insert(jump.target);
+            }
+            leaders.insert(static_cast<Cell>(pc) + inst.length);
+        }
+    }
+    for (Cell leader : leaders) {
+        if (!inImage(leader) || !starts[leader]) {
+            continue;
+        }
+        BasicBlock<Cell> block;
+        block.begin = leader;
+        Cell pc = leader;
+        while (true) {
+            const Instruction<Cell> inst = DecodeInstruction(memory, pc);
+            const Cell next = pc + inst.length;
+            if (inst.handler == kHaltHandler) {
+                block.end = next;
+                break;
+            }
+            if (inst.opcode == JUMP_IF_TRUE || inst.opcode == JUMP_IF_FALSE) {
+                const JumpTargets<Cell> jump = JumpTargetsOf(inst, memory, written, unplacedWrites);
+                if (jump.taken) {
+                    if (jump.known) {
+                        block.successors.push_back(jump.target);
+                    } else {
+                        block.computed = true;
+                    }
+                }
+                if (jump.falls) {
+                    block.successors.push_back(next);
+                }
+                block.end = next;
+                break;
+            }
+            if (leaders.count(next) || !inImage(next)) {
+                block.successors.push_back(next);
+                block.end = next;
+                break;
+            }
+            pc = next;
+        }
+        flow.blocks[leader] = block;
+    }
+
+    // Position mode writes that land on code. Relative ones are in relativeWrites
+    for (size_t pc = 0; pc < size; pc++) {
+        if (!starts[pc]) {
+            continue;
+        }
+        const Instruction<Cell> inst = DecodeInstruction(memory, static_cast<Cell>(pc));
+        const int writes = (inst.opcode == INPUT) ? 0 : (inst.length == 4) ? 2 : -1;
+        if (writes >= 0 && inst.modes[writes] == RELATIVE_MODE) {
+            flow.relativeWrites.insert(static_cast<Cell>(pc));
+        } else if (writes >= 0 && inst.modes[writes] == POSITION_MODE && inImage(inst.operands[writes]) && flow.code[inst.operands[writes]]) {
+            flow.selfModifying[inst.operands[writes]].insert(static_cast<Cell>(pc));
+        }
+    }
+    return flow;
+}
+
+// One instruction as text, like "add [12], 3 -> [rb+4]"
+template <typename Cell>
+std::string Disassemble(const Instruction<Cell>& inst) {
+    static const char* const kNames[] = {"?", "add", "mul", "in", "out", "jt", "jf", "lt", "eq", "arb"};
+    if (inst.handler == kHaltHandler) {
+        return inst.opcode == HALT ? "halt" : "invalid " + std::to_string(inst.opcode);
+    }
+    auto operand = [&](int i) {
+        const std::string value = std::to_string(inst.operands[i]);
+        switch (inst.modes[i]) {
+            case IMMEDIATE_MODE: return value;
+            case RELATIVE_MODE: return std::string(inst.operands[i] < 0 ? "[rb" : "[rb+") + value + "]";
+            default: return "[" + value + "]";
+        }
+    };
+    std::string text = kNames[inst.opcode];
+    switch (inst.length) {
+        case 4: return text + " " + operand(0) + ", " + operand(1) + " -> " + operand(2);
+        case 3: return text + " " + operand(0) + ", " + operand(1);
+        default: return text + (inst.opcode == INPUT ? " -> " : " ") + operand(0);
+    }
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+// Checkpoints: everything needed to carry on a run later, maybe in another process. That is the VM's registers
+// and memory, the I/O still queued in either direction, and whatever the driver wants to keep alongside. The file is
+// "ICKP" and a version byte, then pc, the relative base, the image size and the cells per page of the VM that wrote
+// it, then every page with a non-zero cell as its first address and cells, then the inputs, the outputs and the
+// driver's cells as counted lists. Like traces, everything after the version is a varint, zigzag encoded where
+// it can be negative. The decode cache isn't saved, it's rebuilt as the resumed VM runs.
+
+#include "intcode.h"
+#include "intcode_trace.h"
+
+#include <algorithm>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+#include <cstring>
+
+constexpr char kCheckpointMagic[4] = {'I', 'C', 'K', 'P'};
+constexpr uint8_t kCheckpointVersion = 1;
+
+template <typename Cell>
+struct Checkpoint {
+    Intcode<Cell> intcode;
+    std::vector<Cell> inputs;  // Waiting for the VM to read them
+    std::vector<Cell> outputs; // Written by the VM but not yet taken by the driver
+    std::vector<Cell> driver;  // Laid out however the driver likes
+};
+
+// The values waiting in channel, which keeps them. Only for a channel no other thread is using
+template <typename Cell, size_t Capacity>
+std::vector<Cell> Pending(Channel<Cell, Capacity>* channel) {
+    std::vector<Cell> values;
+    Cell value;
+    while (channel->TryPop(value)) {
+        values.push_back(value);
+    }
+    for (Cell v : values) {
+        channel->TryPush(v);
+    }
+    return values;
+}
+
+template <typename Cell>
+bool WriteCheckpoint(const std::string& path, const Checkpoint<Cell>& checkpoint) {
+    const Intcode<Cell>& intcode = checkpoint.intcode;
+    std::vector<uint8_t> bytes(std::begin(kCheckpointMagic), std::end(kCheckpointMagic));
+    bytes.push_back(kCheckpointVersion);
+    WriteVarint(bytes, ZigZag(static_cast<int64_t>(intcode.pc)));
+    WriteVarint(bytes, ZigZag(static_cast<int64_t>(intcode.relativeBase)));
+    WriteVarint(bytes, intcode.memory.ImageSize());
+    WriteVarint(bytes, Memory<Cell>::kPageCells);
+    size_t pages = 0;
+    intcode.memory.ForEachPage([&](auto, const auto& page) {
+        pages += std::any_of(page.begin(), page.end(), [](Cell cell) { return cell != 0; });
+    });
+    WriteVarint(bytes, pages);
+    intcode.memory.ForEachPage([&](auto first, const auto& page) {
+        if (std::any_of(page.begin(), page.end(), [](Cell cell) { return cell != 0; })) {
+            WriteVarint(bytes, first);
+            for (Cell cell : page) {
+                WriteVarint(bytes, ZigZag(static_cast<int64_t>(cell)));
+            }
+        }
+    });
+    WriteCells(bytes, checkpoint.inputs);
+    WriteCells(bytes, checkpoint.outputs);
+    WriteCells(bytes, checkpoint.driver);
+    return WriteFileAtomically(path, bytes);
+}
+
+template <typename Cell>
+std::optional<Checkpoint<Cell>> ReadCheckpoint(const std::string& path) {
+    std::optional<InputFile> input = LoadInput(path);
+    if (!input) {
+        return {};
+    }
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(input->begin());
+    const uint8_t* end = reinterpret_cast<const uint8_t*>(input->end());
+    if (end - p < 5 || std::memcmp(p, kCheckpointMagic, sizeof(kCheckpointMagic)) != 0) {
+        std::cerr << path << " is not an Intcode checkpoint\n";
+        return {};
+    }
+    if (p[4] != kCheckpointVersion) {
+        std::cerr << path << " is a version " << static_cast<int>(p[4]) << " checkpoint, expected " << static_cast<int>(kCheckpointVersion) << "\n";
+        return {};
+    }
+    p += 5;
+
+    auto corrupt = [&]() {
+        std::cerr << path << " is truncated, corrupt or too wide for this VM\n";
+        return std::optional<Checkpoint<Cell>>();
+    };
+    Checkpoint<Cell> checkpoint;
+    Intcode<Cell>& intcode = checkpoint.intcode;
+    uint64_t imageSize, pageCells, pages;
+    if (!ReadCell(p, end, intcode.pc) || !ReadCell(p, end, intcode.relativeBase) || !ReadVarint(p, end, imageSize) ||
+        !ReadVarint(p, end, pageCells) || !ReadVarint(p, end, pages) ||
+        imageSize > Memory<Cell>::kDirectoryPages * Memory<Cell>::kPageCells) {
+        return corrupt();
+    }
+    // Pages are written back a cell at a time, so a checkpoint from a VM with a different page size still loads
+    intcode.memory = Memory<Cell>(std::vector<Cell>(imageSize));
+    for (uint64_t page = 0; page < pages; page++) {
+        uint64_t first;
+        if (!ReadVarint(p, end, first)) {
+            return corrupt();
+        }
+        for (uint64_t i = 0; i < pageCells; i++) {
+            Cell cell;
+            if (!ReadCell(p, end, cell)) {
+                return corrupt();
+            }
+            if (cell != 0) {
+                intcode.memory[static_cast<Cell>(first + i)] = cell;
+            }
+        }
+    }
+    if (!ReadCells(p, end, checkpoint.inputs) || !ReadCells(p, end, checkpoint.outputs) ||
+        !ReadCells(p, end, checkpoint.driver) || p != end) {
+        return corrupt();
+    }
+    return checkpoint;
+}
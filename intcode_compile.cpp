@@ -0,0 +1,29 @@
+#include "clue.h"
+#include "intcode.h"
+#include "intcode_image.h"
+#include <fstream>
+#include <iostream>
+
+// Turns a comma separated Intcode program into a binary image every day can load in place of the text
+struct Args {
+    std::string program;
+    std::string image;
+    int cellBytes = 8; // 4 halves the image for days 2, 5 and 7, whose VMs have int cells
+};
+
+int main(int argc, char** argv) {
+    clue::CommandLine<Args> cl;
+    cl.Optional(&Args::cellBytes, "cellBytes");
+    cl.Positional(&Args::program, "program", "Comma separated program to read", clue::kRequired);
+    cl.Positional(&Args::image, "image", "Image to write", clue::kRequired);
+    auto args = cl.ParseArgs(argc, argv);
+
+    std::ifstream file(args->program);
+    if (!file) {
+        std::cerr << "can't open " << args->program << "\n";
+        return 1;
+    }
+    if (!WriteImage(args->image, ReadProgram<int64_t>(file), static_cast<size_t>(args->cellBytes))) {
+        return 1;
+    }
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+// Cooperative Intcode VMs on C++20 coroutines. Each VM is a coroutine that co_awaits its input mailbox and
+// pushes what it outputs to its output mailbox. A Scheduler multiplexes any number of them on one thread: a VM waiting on an
+// empty mailbox is parked on it and only becomes runnable again when a value is delivered, so nothing polls.
+
+#include "intcode.h"
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <vector>
+
+#include <cstddef>
+
+template <typename Cell>
+class Scheduler;
+
+// Unbounded queue of values for one VM. Remembers the VM waiting on it, if any
+template <typename Cell>
+class Mailbox {
+  public:
+    explicit Mailbox(Scheduler<Cell>& scheduler) : scheduler_(&scheduler) {}
+    Mailbox(const Mailbox&) = delete;
+    Mailbox& operator=(const Mailbox&) = delete;
+
+    void Push(Cell value) {
+        values_.push_back(value);
+        if (waiter_) {
+            scheduler_->Wake(waiter_);
+            waiter_ = nullptr;
+        }
+    }
+
+    bool TryPop(Cell& value) {
+        if (values_.empty()) {
+            return false;
+        }
+        value = values_.front();
+        values_.pop_front();
+        return true;
+    }
+
+    bool Empty() const { return values_.empty(); }
+
+    // co_await mailbox.Readable() suspends until the mailbox has a value
+    auto Readable() {
+        struct Awaiter {
+            Mailbox* mailbox;
+            bool await_ready() const noexcept { return !mailbox->Empty(); }
+            void await_suspend(std::coroutine_handle<> handle) noexcept { mailbox->waiter_ = handle; }
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{this};
+    }
+
+  private:
+    Scheduler<Cell>* scheduler_;
+    std::deque<Cell> values_;
+    std::coroutine_handle<> waiter_;
+};
+
+template <typename Cell>
+class VmTask {
+  public:
+    struct promise_type {
+        VmTask get_return_object() { return VmTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    explicit VmTask(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+    VmTask(VmTask&& other) noexcept : handle_(other.handle_) { other.handle_ = nullptr; }
+    VmTask(const VmTask&) = delete;
+    VmTask& operator=(const VmTask&) = delete;
+    ~VmTask() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    std::coroutine_handle<promise_type> Handle() const { return handle_; }
+    bool Done() const { return handle_.done(); }
+
+  private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// Collects outputs during one RunProgram slice, interrupting with kOutput once the buffer is full so the
+// coroutine can hand them on
+template <typename Cell, size_t Capacity>
+struct BufferedOutput {
+    Cell* values;
+    size_t* count;
+    bool operator()(Cell value) {
+        if (*count == Capacity) {
+            return false;
+        }
+        values[(*count)++] = value;
+        return true;
+    }
+};
+
+template <typename Cell>
+VmTask<Cell> RunCoroutine(Intcode<Cell>& intcode, Mailbox<Cell>& inputs, Mailbox<Cell>& outputs) {
+    constexpr size_t kBufferSize = 64;
+    Cell buffer[kBufferSize];
+    while (true) {
+        size_t count = 0;
+        Interrupt interrupt = RunProgram(intcode,
+            [&](Cell& value) { return inputs.TryPop(value); },
+            BufferedOutput<Cell, kBufferSize>{buffer, &count});
+        // Delivering an output never suspends the VM, it only wakes whoever reads the mailbox
+        for (size_t i = 0; i < count; i++) {
+            outputs.Push(buffer[i]);
+        }
+        if (interrupt == kHalt) {
+            co_return;
+        } else if (interrupt == kInput) {
+            co_await inputs.Readable();
+        }
+    }
+}
+
+template <typename Cell>
+class Scheduler {
+  public:
+    // The VM and both mailboxes must outlive the scheduler run
+    void Spawn(Intcode<Cell>& intcode, Mailbox<Cell>& inputs, Mailbox<Cell>& outputs) {
+        tasks_.push_back(RunCoroutine(intcode, inputs, outputs));
+        ready_.push_back(tasks_.back().Handle());
+    }
+
+    void Wake(std::coroutine_handle<> handle) {
+        ready_.push_back(handle);
+    }
+
+    // Resumes runnable VMs until every VM has halted or is waiting on an empty mailbox
+    void Run() {
+        while (!ready_.empty()) {
+            std::coroutine_handle<> handle = ready_.front();
+            ready_.pop_front();
+            handle.resume();
+        }
+    }
+
+    size_t Halted() const {
+        size_t halted = 0;
+        for (const auto& task : tasks_) {
+            halted += task.Done();
+        }
+        return halted;
+    }
+
+  private:
+    std::vector<VmTask<Cell>> tasks_;
+    std::deque<std::coroutine_handle<>> ready_;
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+// Binary Intcode images, so a VM can start on a program without parsing it. The layout is a 16 byte header
+//   0  "INTC"
+//   4  version, currently 1
+//   5  bytes per cell, 4 or 8
+//   6  two bytes of zero
+//   8  number of cells, 64-bit
+// followed by the cells, two's complement, all of it little-endian. intcode_compile turns a text program into
+// an image. On POSIX systems images are mapped rather than read: when the cell width matches and the host is
+// little-endian every full page of the program is used straight from the mapping, and only pages the program
+// writes are copied.
+
+#include "input.h"
+#include "intcode.h"
+
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+#include <cstring>
+
+constexpr char kImageMagic[4] = {'I', 'N', 'T', 'C'};
+constexpr uint8_t kImageVersion = 1;
+constexpr size_t kImageHeaderSize = 16;
+
+// Little-endian integer of width bytes at bytes, sign extended
+inline int64_t ReadLittleEndian(const uint8_t* bytes, size_t width) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < width; i++) {
+        value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+    }
+    if (width < 8 && (value >> (8 * width - 1)) & 1) {
+        value |= ~uint64_t{0} << (8 * width);
+    }
+    return static_cast<int64_t>(value);
+}
+
+inline void WriteLittleEndian(std::vector<uint8_t>& bytes, uint64_t value, size_t width) {
+    for (size_t i = 0; i < width; i++) {
+        bytes.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+// Writes program as an image with cellBytes bytes per cell. Fails if a cell doesn't fit or the file can't be written
+template <typename Cell>
+bool WriteImage(const std::string& path, const std::vector<Cell>& program, size_t cellBytes = sizeof(Cell)) {
+    if (cellBytes != 4 && cellBytes != 8) {
+        std::cerr << "images have 4 or 8 bytes per cell\n";
+        return false;
+    }
+    std::vector<uint8_t> bytes(std::begin(kImageMagic), std::end(kImageMagic));
+    bytes.push_back(kImageVersion);
+    bytes.push_back(static_cast<uint8_t>(cellBytes));
+    WriteLittleEndian(bytes, 0, 2);
+    WriteLittleEndian(bytes, program.size(), 8);
+    for (Cell cell : program) {
+        const int64_t value = static_cast<int64_t>(cell);
+        if (cellBytes == 4 && (value < std::numeric_limits<int32_t>::min() || value > std::numeric_limits<int32_t>::max())) {
+            std::cerr << value << " doesn't fit in 4 bytes\n";
+            return false;
+        }
+        WriteLittleEndian(bytes, static_cast<uint64_t>(value), cellBytes);
+    }
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    return file.good();
+}
+
+// The cells of the image in data, which is size bytes and stays alive as long as owner does. Converts them if the
+// image's cell width isn't Cell's, or the host isn't little-endian
+template <typename Cell>
+std::optional<Memory<Cell>> DecodeImage(uint8_t* data, size_t size, const std::shared_ptr<void>& owner, const std::string& path) {
+    if (size < kImageHeaderSize || std::memcmp(data, kImageMagic, sizeof(kImageMagic)) != 0) {
+        std::cerr << path << " is not an Intcode image\n";
+        return {};
+    }
+    const uint8_t version = data[4];
+    const size_t cellBytes = data[5];
+    const uint64_t count = static_cast<uint64_t>(ReadLittleEndian(data + 8, 8));
+    if (version != kImageVersion) {
+        std::cerr << path << " is a version " << static_cast<int>(version) << " image, expected " << static_cast<int>(kImageVersion) << "\n";
+        return {};
+    }
+    if ((cellBytes != 4 && cellBytes != 8) || count > (size - kImageHeaderSize) / cellBytes ||
+        kImageHeaderSize + count * cellBytes != size) {
+        std::cerr << path << " is truncated or corrupt\n";
+        return {};
+    }
+    uint8_t* cells = data + kImageHeaderSize;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (cellBytes == sizeof(Cell) && owner) {
+        return Memory<Cell>(reinterpret_cast<Cell*>(cells), count, owner);
+    }
+#endif
+    std::vector<Cell> image(count);
+    for (size_t i = 0; i < count; i++) {
+        const int64_t value = ReadLittleEndian(cells + i * cellBytes, cellBytes);
+        if (value < static_cast<int64_t>(std::numeric_limits<Cell>::min()) || value > static_cast<int64_t>(std::numeric_limits<Cell>::max())) {
+            std::cerr << path << " has cells too wide for this VM\n";
+            return {};
+        }
+        image[i] = static_cast<Cell>(value);
+    }
+    return Memory<Cell>(image);
+}
+
+// Maps or reads the image at path
+template <typename Cell>
+std::optional<Memory<Cell>> LoadImage(const std::string& path) {
+    std::optional<InputFile> input = LoadInput(path);
+    if (!input) {
+        return {};
+    }
+    // The mapping is page aligned, so cells after the 16 byte header are aligned for either width
+    return DecodeImage<Cell>(reinterpret_cast<uint8_t*>(input->data), input->size, input->owner, path);
+}
+
+// The program at path, whether it is an image or comma separated text
+template <typename Cell>
+std::optional<Memory<Cell>> OpenProgram(const std::string& path) {
+    std::optional<InputFile> input = LoadInput(path);
+    if (!input) {
+        return {};
+    }
+    if (input->size >= sizeof(kImageMagic) && std::memcmp(input->data, kImageMagic, sizeof(kImageMagic)) == 0) {
+        return DecodeImage<Cell>(reinterpret_cast<uint8_t*>(input->data), input->size, input->owner, path);
+    }
+    return Memory<Cell>(ParseIntegers<Cell>(input->begin(), input->end()));
+}
@@ -0,0 +1,706 @@
+#pragma once
+
+// Second tier for long running Intcode programs. Basic blocks are compiled to x86-64 the first time they are
+// reached and RunProgram stays as the fallback for everything else. A block is a straight run of instructions
+// that ends at a jump, which it compiles too, or at the first instruction it can't compile (HALT, writes in
+// immediate mode). Blocks jump straight into each other, and INPUT and OUTPUT call the same sinks RunProgram
+// would. Generated code works on Memory's pages directly and side-exits to the interpreter, with pc on the
+// instruction it couldn't finish, when
+//  - a load or store lands on a page that doesn't exist yet, or a store on a page shared with a fork
+//  - a store would land on a cell that holds code. RunProgram makes the write and counts it in Intcode::rewrites,
+//    and blocks check their code is unchanged before running again whenever that count has moved
+//  - a sink has nothing to give or no room, so RunProgram can interrupt the same way it always does
+// Code cells found to have changed are volatile from then on: blocks are recompiled to read them from memory
+// instead of baking them in, which is what programs that keep variables in operands need (day 13 does).
+// The relative base stays in a register for the whole block and is written back on every exit, so blocks are
+// not specialised on it and need no guard for it.
+// x86-64 System V only. INTCODE_JIT is 0 everywhere else and nothing below is declared.
+
+#include "intcode.h"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define INTCODE_JIT 1
+#else
+#define INTCODE_JIT 0
+#endif
+
+#if INTCODE_JIT
+
+#include <sys/mman.h>
+
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <type_traits>
+
+class Jit;
+
+// Shared with generated code, which reaches the fields by offset
+struct JitContext {
+    int64_t pc;
+    int64_t relativeBase;
+    const int64_t* const* readPages;
+    int64_t* const* writePages;
+    uint64_t pageCount;
+    const Instruction<int64_t>* decoded;
+    uint64_t decodedSize;
+    int64_t decodedEnd;
+    const void* const* entries; // Compiled code by pc, null where a block has to go through Jit first. decodedSize long
+    int64_t block;              // The block that side-exited
+    // INPUT and OUTPUT call back into RunJit's sinks, passing the value through value. A zero return means the
+    // sink had nothing to give or no room, and the block side-exits so the interpreter can report it
+    void* io;
+    int (*read)(JitContext*);
+    int (*write)(JitContext*);
+    int64_t value;
+    // Called before a store to a code cell. Stores to volatile cells go ahead, anything else side-exits
+    Jit* jit;
+    int (*forget)(JitContext*, int64_t cell);
+};
+
+// Just the encodings the block compiler needs. Every operation is on 64-bit registers unless its name says otherwise
+class X64Assembler {
+  public:
+    enum Reg : uint8_t { RAX = 0, RCX = 1, RDX = 2, RSI = 6, RDI = 7, R8 = 8, R9 = 9, R10 = 10, R11 = 11 };
+    enum Condition : uint8_t { kAboveOrEqual = 0x3, kEqual = 0x4, kNotEqual = 0x5, kLess = 0xc };
+    enum Alu : uint8_t { kAdd = 0x01, kCmp = 0x39, kTest = 0x85, kMov = 0x89 };
+
+    std::vector<uint8_t> code;
+
+    // op dst, src
+    void AluRegReg(Alu op, Reg dst, Reg src) { Rex(src, 0, dst); Byte(op); ModRM(3, src, dst); }
+    void ImulRegReg(Reg dst, Reg src) { Rex(dst, 0, src); Byte(0x0f); Byte(0xaf); ModRM(3, dst, src); }
+    void ImulRegImm(Reg dst, int32_t imm) { Rex(dst, 0, dst); Byte(0x69); ModRM(3, dst, dst); Int32(imm); }
+    void ShrRegImm(Reg dst, uint8_t imm) { Rex(0, 0, dst); Byte(0xc1); ModRM(3, 5, dst); Byte(imm); }
+    void AndEaxImm(int32_t imm) { Byte(0x25); Int32(imm); } // Clears the top half of rax as well
+
+    void MovRegImm(Reg dst, int64_t imm) {
+        if (imm == static_cast<int32_t>(imm)) {
+            Rex(0, 0, dst); Byte(0xc7); ModRM(3, 0, dst); Int32(static_cast<int32_t>(imm));
+        } else {
+            Rex(0, 0, dst); Byte(0xb8 + (dst & 7)); Int64(imm);
+        }
+    }
+    void MovEaxImm(int32_t imm) { Byte(0xb8); Int32(imm); }
+
+    // [base + disp8]
+    void Load(Reg dst, Reg base, int8_t disp) { Rex(dst, 0, base); Byte(0x8b); ModRM(1, dst, base); Byte(static_cast<uint8_t>(disp)); }
+    void Store(Reg base, int8_t disp, Reg src) { Rex(src, 0, base); Byte(0x89); ModRM(1, src, base); Byte(static_cast<uint8_t>(disp)); }
+    void CmpRegMem(Reg dst, Reg base, int8_t disp) { Rex(dst, 0, base); Byte(0x3b); ModRM(1, dst, base); Byte(static_cast<uint8_t>(disp)); }
+
+    // [base + index * 8]
+    void LoadIndexed(Reg dst, Reg base, Reg index) { Rex(dst, index, base); Byte(0x8b); ModRM(0, dst, 4); Sib(3, index, base); }
+    void StoreIndexed(Reg base, Reg index, Reg src) { Rex(src, index, base); Byte(0x89); ModRM(0, src, 4); Sib(3, index, base); }
+
+    // test byte [base + index + disp8], imm8
+    void TestByte(Reg base, Reg index, int8_t disp, uint8_t imm) {
+        if ((base | index) & 8) {
+            Byte(0x40 | ((index >> 3) << 1) | (base >> 3));
+        }
+        Byte(0xf6); ModRM(1, 0, 4); Sib(0, index, base); Byte(static_cast<uint8_t>(disp)); Byte(imm);
+    }
+
+    // setcc dl, then zero extend it into dst
+    void SetDl(Condition cc) { Byte(0x0f); Byte(0x90 + cc); ModRM(3, 0, RDX); }
+    void MovzxDl(Reg dst) {
+        if (dst & 8) {
+            Byte(0x44);
+        }
+        Byte(0x0f); Byte(0xb6); ModRM(3, dst, RDX);
+    }
+    void Cmov(Condition cc, Reg dst, Reg src) { Rex(dst, 0, src); Byte(0x0f); Byte(0x40 + cc); ModRM(3, dst, src); }
+    void JmpReg(Reg target) {
+        if (target & 8) {
+            Byte(0x41);
+        }
+        Byte(0xff); ModRM(3, 4, target);
+    }
+
+    // Jumps return where their rel32 is so it can be patched once the target is known
+    size_t Jcc(Condition cc) { Byte(0x0f); Byte(0x80 + cc); return Rel32(); }
+    size_t Jmp() { Byte(0xe9); return Rel32(); }
+    void Patch(size_t rel32, size_t target) {
+        const int32_t offset = static_cast<int32_t>(target - (rel32 + 4));
+        std::memcpy(&code[rel32], &offset, 4);
+    }
+    void Ret() { Byte(0xc3); }
+    void Push(Reg r) { if (r & 8) { Byte(0x41); } Byte(0x50 + (r & 7)); }
+    void Pop(Reg r) { if (r & 8) { Byte(0x41); } Byte(0x58 + (r & 7)); }
+    void CallMem(Reg base, int8_t disp) { Byte(0xff); ModRM(1, 2, base); Byte(static_cast<uint8_t>(disp)); }
+    void TestEaxEax() { Byte(0x85); Byte(0xc0); }
+
+  private:
+    void Byte(uint8_t b) { code.push_back(b); }
+    void Int32(int32_t v) { code.insert(code.end(), reinterpret_cast<uint8_t*>(&v), reinterpret_cast<uint8_t*>(&v) + 4); }
+    void Int64(int64_t v) { code.insert(code.end(), reinterpret_cast<uint8_t*>(&v), reinterpret_cast<uint8_t*>(&v) + 8); }
+    size_t Rel32() { Int32(0); return code.size() - 4; }
+    void Rex(int reg, int index, int base) { Byte(0x48 | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3)); }
+    void ModRM(int mod, int reg, int rm) { Byte(static_cast<uint8_t>((mod << 6) | ((reg & 7) << 3) | (rm & 7))); }
+    void Sib(int scale, int index, int base) { Byte(static_cast<uint8_t>((scale << 6) | ((index & 7) << 3) | (base & 7))); }
+};
+
+// Code is copied in while its chunk is writable and only ever runs once the chunk is executable again
+class ExecutableMemory {
+  public:
+    static constexpr size_t kChunkSize = 1 << 20;
+
+    ExecutableMemory() = default;
+    ExecutableMemory(const ExecutableMemory&) = delete;
+    ExecutableMemory& operator=(const ExecutableMemory&) = delete;
+    ~ExecutableMemory() {
+        for (const Chunk& chunk : chunks_) {
+            munmap(chunk.base, kChunkSize);
+        }
+    }
+
+    // Where the code went, or nullptr if it doesn't fit or the OS refused
+    const void* Add(const std::vector<uint8_t>& code) {
+        if (code.size() > kChunkSize) {
+            return nullptr;
+        }
+        if (chunks_.empty() || chunks_.back().used + code.size() > kChunkSize) {
+            void* base = mmap(nullptr, kChunkSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (base == MAP_FAILED) {
+                return nullptr;
+            }
+            chunks_.push_back({static_cast<uint8_t*>(base), 0});
+        } else if (mprotect(chunks_.back().base, kChunkSize, PROT_READ | PROT_WRITE) != 0) {
+            return nullptr;
+        }
+        Chunk& chunk = chunks_.back();
+        uint8_t* at = chunk.base + chunk.used;
+        std::memcpy(at, code.data(), code.size());
+        chunk.used += (code.size() + 15) & ~static_cast<size_t>(15);
+        if (mprotect(chunk.base, kChunkSize, PROT_READ | PROT_EXEC) != 0) {
+            return nullptr;
+        }
+        return at;
+    }
+
+  private:
+    struct Chunk {
+        uint8_t* base;
+        size_t used;
+    };
+    std::vector<Chunk> chunks_;
+};
+
+// Lets generated code call an input and an output sink of any type
+template <typename Input, typename Output>
+struct JitSinks {
+    Input* input;
+    Output* output;
+
+    static int Read(JitContext* context) {
+        return (*static_cast<JitSinks*>(context->io)->input)(context->value);
+    }
+    static int Write(JitContext* context) {
+        Output& output = *static_cast<JitSinks*>(context->io)->output;
+        if constexpr (std::is_same_v<decltype(output(int64_t{})), bool>) {
+            return output(context->value);
+        } else {
+            output(context->value);
+            return 1;
+        }
+    }
+};
+
+// Compiled blocks for one VM, keyed by the pc they start at. Keep one Jit per Intcode and only run that Intcode
+// through RunJit, as the breakpoints the Jit leaves in its decode cache would stop a plain RunProgram
+class Jit {
+  public:
+    static constexpr int kMaxBlockInstructions = 64;
+    static constexpr int kMaxSideExits = 64; // A block that keeps bailing out is left to the interpreter for good
+    static constexpr int kMaxRecompiles = 8;
+
+    // Runs compiled blocks for as long as there is one at intcode.pc
+    template <typename Input, typename Output>
+    void RunBlocks(Intcode<int64_t>& intcode, JitSinks<Input, Output>& sinks) {
+        context_.io = &sinks;
+        context_.read = &JitSinks<Input, Output>::Read;
+        context_.write = &JitSinks<Input, Output>::Write;
+        context_.jit = this;
+        context_.forget = &Jit::Forget;
+        intcode_ = &intcode;
+        Attach(intcode);
+        if (version_ != Version(intcode)) {
+            Unpublish(intcode);
+        }
+        while (Block* block = Lookup(intcode)) {
+            context_.pc = intcode.pc;
+            context_.relativeBase = intcode.relativeBase;
+            const int status = block->function(&context_);
+            intcode.pc = context_.pc;
+            intcode.relativeBase = context_.relativeBase;
+            if (status == kSinkFailed) {
+                return;
+            } else if (status == kSideExit) {
+                if (++blocks_[context_.block].sideExits > kMaxSideExits) {
+                    Kill(intcode, context_.block);
+                }
+                return;
+            }
+        }
+    }
+
+    // The interpreter is about to run the instruction at intcode.pc. Compile the block after it, so the interpreter
+    // comes back as soon as it is done with the instruction
+    void BreakAfter(Intcode<int64_t>& intcode) {
+        const int64_t pc = intcode.pc;
+        if (pc < 0 || static_cast<size_t>(pc) >= blocks_.size()) {
+            return;
+        }
+        Lookup(intcode, pc + DecodeInstruction(intcode.memory, pc).length);
+    }
+
+    // The interpreter may have moved pages or the decode cache
+    void Attach(Intcode<int64_t>& intcode) {
+        Memory<int64_t>& memory = intcode.memory;
+        if (!intcode.decoded || intcode.decoded->size() != memory.ImageSize()) {
+            intcode.decoded = std::make_shared<std::vector<Instruction<int64_t>>>(memory.ImageSize());
+            intcode.decodedEnd = 0;
+            blocks_.clear(); // Their flags and breakpoints went with the old cache
+            entries_.clear();
+            published_.clear();
+        } else if (intcode.decoded.use_count() > 1) {
+            intcode.decoded = std::make_shared<std::vector<Instruction<int64_t>>>(*intcode.decoded);
+        }
+        if (blocks_.size() != memory.ImageSize()) {
+            blocks_.assign(memory.ImageSize(), Block{});
+            entries_.assign(memory.ImageSize(), nullptr);
+            published_.clear();
+            volatile_.assign(memory.ImageSize(), false);
+        }
+        const size_t pages = memory.DirectoryPages();
+        readPages_.resize(pages);
+        writePages_.resize(pages);
+        for (size_t page = 0; page < pages; page++) {
+            readPages_[page] = memory.PageData(page);
+            writePages_[page] = memory.OwnedPageData(page);
+        }
+        context_.readPages = readPages_.data();
+        context_.writePages = writePages_.data();
+        context_.pageCount = pages;
+        context_.decoded = intcode.decoded->data();
+        context_.decodedSize = intcode.decoded->size();
+        context_.decodedEnd = intcode.decodedEnd;
+        context_.entries = entries_.data();
+    }
+
+    size_t CompiledBlocks() const {
+        return std::count_if(blocks_.begin(), blocks_.end(), [](const Block& b) { return b.state == kCompiled; });
+    }
+
+  private:
+    using BlockFunction = int (*)(JitContext*);
+    static_assert(sizeof(JitContext) <= 128, "Generated code reaches JitContext with 8-bit offsets");
+    static constexpr int kBlockDone = 0;
+    static constexpr int kSideExit = 1;
+    static constexpr int kSinkFailed = 2; // Waiting on a sink is no reason to give up on a block
+
+    enum BlockState : uint8_t { kUntried, kCompiled, kUncompilable, kDead };
+
+    struct Block {
+        BlockState state = kUntried;
+        int sideExits = 0;
+        int recompiles = 0;
+        BlockFunction function = nullptr;
+        int64_t end = 0;
+        uint64_t version = 0; // Version() when the code was last known to match
+        std::vector<std::pair<int64_t, int64_t>> constants; // Cells compiled in as constants, and their values
+    };
+
+    // Moves on whenever code may have changed under a block: RunProgram wrote to a code cell, or a cell that some
+    // blocks have compiled in as a constant turned volatile
+    uint64_t Version(const Intcode<int64_t>& intcode) const {
+        return intcode.rewrites + volatileCells_;
+    }
+
+    // Blocks jump straight to each other through entries_, which only holds blocks checked since the version last
+    // moved on. Anything else comes back to RunBlocks to be compiled or checked first
+    void Unpublish(const Intcode<int64_t>& intcode) {
+        for (int64_t pc : published_) {
+            entries_[pc] = nullptr;
+        }
+        published_.clear();
+        version_ = Version(intcode);
+    }
+
+    Block* Lookup(Intcode<int64_t>& intcode) {
+        return Lookup(intcode, intcode.pc);
+    }
+
+    Block* Lookup(Intcode<int64_t>& intcode, int64_t pc) {
+        if (pc < 0 || static_cast<size_t>(pc) >= blocks_.size()) {
+            return nullptr;
+        }
+        Block& block = blocks_[pc];
+        if (block.state == kCompiled && block.version != Version(intcode)) {
+            // Cells that changed are read from memory from now on. Programs keep variables in operands, so this
+            // is usually all it takes for the block to settle down
+            bool stale = false;
+            for (const auto& [cell, value] : block.constants) {
+                if (!volatile_[cell] && intcode.memory.Load(cell) != value) {
+                    MakeVolatile(intcode, cell);
+                }
+                stale |= volatile_[cell];
+            }
+            if (stale) {
+                Kill(intcode, pc);
+                block.state = (++block.recompiles <= kMaxRecompiles) ? kUntried : kDead;
+                Unpublish(intcode);
+            } else {
+                block.version = Version(intcode);
+                Mark(intcode, pc, block);
+            }
+        }
+        if (block.state == kUntried) {
+            block.state = Compile(intcode.memory, pc, block) ? kCompiled : kUncompilable;
+            if (block.state == kCompiled) {
+                block.version = Version(intcode);
+                Mark(intcode, pc, block);
+            }
+        }
+        if (block.state != kCompiled) {
+            return nullptr;
+        }
+        if (!entries_[pc]) {
+            entries_[pc] = reinterpret_cast<const void*>(block.function);
+            published_.push_back(pc);
+        }
+        return &block;
+    }
+
+    // Flags the cells compiled in as constants as code so writes to them, from the interpreter or from other
+    // blocks, get noticed, and sets a breakpoint on the first instruction so the interpreter hands it back. The
+    // breakpoint has an empty span so no write drops it
+    void Mark(Intcode<int64_t>& intcode, int64_t pc, const Block& block) {
+        auto& decoded = *intcode.decoded;
+        for (const auto& constant : block.constants) {
+            decoded[constant.first].flags |= kCodeFlag;
+        }
+        decoded[pc].handler = kBreakHandler;
+        decoded[pc].span = 0;
+        intcode.decodedEnd = std::max(intcode.decodedEnd, block.end);
+    }
+
+    // Compiled code treats a volatile cell as data, so it loses its code flag. Whatever the interpreter has cached
+    // over it is dropped first, the same way RunProgram drops records on a self-modifying write
+    void MakeVolatile(Intcode<int64_t>& intcode, int64_t cell) {
+        Uncache(intcode, cell);
+        volatile_[cell] = true;
+        volatileCells_++;
+    }
+
+    void Uncache(Intcode<int64_t>& intcode, int64_t cell) {
+        auto& decoded = *intcode.decoded;
+        for (int64_t a = std::max<int64_t>(cell - (kMaxSpan - 1), 0); a <= cell; a++) {
+            Instruction<int64_t>& record = decoded[a];
+            if (record.handler != kDecodeHandler && record.handler != kBreakHandler && a + record.span > cell) {
+                record.handler = kDecodeHandler;
+                record.flags |= kRewrittenFlag;
+            }
+        }
+        decoded[cell].flags &= ~(kCodeFlag | kFusedFlag);
+    }
+
+    // The interpreter flags a volatile cell as code again whenever it decodes an instruction over it, and compiled
+    // code that writes the cell has to drop that instruction again
+    static int Forget(JitContext* context, int64_t cell) {
+        Jit& jit = *context->jit;
+        if (!jit.volatile_[cell]) {
+            return 0;
+        }
+        jit.Uncache(*jit.intcode_, cell);
+        return 1;
+    }
+
+    void Kill(Intcode<int64_t>& intcode, int64_t pc) {
+        blocks_[pc].state = kDead;
+        entries_[pc] = nullptr;
+        blocks_[pc].constants.clear();
+        auto& record = (*intcode.decoded)[pc];
+        if (record.handler == kBreakHandler) {
+            record.handler = kDecodeHandler;
+        }
+    }
+
+    bool Compile(const Memory<int64_t>& memory, int64_t entry, Block& block) {
+        using A = X64Assembler;
+        constexpr int kPageShift = __builtin_ctzll(Memory<int64_t>::kPageCells);
+        constexpr int8_t kPc = offsetof(JitContext, pc);
+        constexpr int8_t kRelativeBase = offsetof(JitContext, relativeBase);
+        constexpr int8_t kReadPages = offsetof(JitContext, readPages);
+        constexpr int8_t kWritePages = offsetof(JitContext, writePages);
+        constexpr int8_t kPageCount = offsetof(JitContext, pageCount);
+        constexpr int8_t kDecoded = offsetof(JitContext, decoded);
+        constexpr int8_t kDecodedSize = offsetof(JitContext, decodedSize);
+        constexpr int8_t kEntries = offsetof(JitContext, entries);
+        constexpr int8_t kDecodedEnd = offsetof(JitContext, decodedEnd);
+        constexpr int8_t kBlock = offsetof(JitContext, block);
+        constexpr int8_t kRead = offsetof(JitContext, read);
+        constexpr int8_t kWrite = offsetof(JitContext, write);
+        constexpr int8_t kValue = offsetof(JitContext, value);
+        constexpr int8_t kForget = offsetof(JitContext, forget);
+        constexpr int8_t kFlags = offsetof(Instruction<int64_t>, flags);
+
+        // Register use: rdi the context, rcx the relative base, r8/r9 the read/write page tables, r11 the decode
+        // cache. r10 and rsi hold operands, rax addresses and rdx whatever the address is being checked against
+        A a;
+        struct SideExit {
+            size_t rel32;
+            int64_t pc;
+            int status;
+        };
+        std::vector<SideExit> sideExits;
+        int64_t pc = entry;
+        auto sideExit = [&](A::Condition cc, int status = kSideExit) {
+            sideExits.push_back({a.Jcc(cc), pc, status});
+        };
+        // Calls through the context with the stack aligned, keeping two registers or none, then side-exits with
+        // status if the callee returned 0. Everything but rdi is the callee's, so the block's registers are reloaded
+        auto call = [&](int8_t function, std::initializer_list<A::Reg> keep, int status) {
+            a.Store(A::RDI, kRelativeBase, A::RCX);
+            for (A::Reg r : keep) {
+                a.Push(r);
+            }
+            a.Push(A::RDI);
+            a.CallMem(A::RDI, function);
+            a.TestEaxEax(); // Before rax can be popped. Neither the pops nor the reloads touch the flags
+            a.Pop(A::RDI);
+            for (auto r = std::rbegin(keep); r != std::rend(keep); ++r) {
+                a.Pop(*r);
+            }
+            a.Load(A::RCX, A::RDI, kRelativeBase);
+            a.Load(A::R8, A::RDI, kReadPages);
+            a.Load(A::R9, A::RDI, kWritePages);
+            a.Load(A::R11, A::RDI, kDecoded);
+            sideExit(A::kEqual, status);
+        };
+        auto leave = [&](int status) {
+            a.Store(A::RDI, kPc, A::RAX);
+            a.Store(A::RDI, kRelativeBase, A::RCX);
+            a.MovEaxImm(status);
+            a.Ret();
+        };
+        // Carries on at the pc in rax, jumping straight into its block if it has one ready
+        auto next = [&]() {
+            a.Store(A::RDI, kPc, A::RAX);
+            a.Store(A::RDI, kRelativeBase, A::RCX);
+            a.CmpRegMem(A::RAX, A::RDI, kDecodedSize);
+            const size_t outside = a.Jcc(A::kAboveOrEqual);
+            a.Load(A::RDX, A::RDI, kEntries);
+            a.LoadIndexed(A::RDX, A::RDX, A::RAX);
+            a.AluRegReg(A::kTest, A::RDX, A::RDX);
+            const size_t notReady = a.Jcc(A::kEqual);
+            a.JmpReg(A::RDX);
+            a.Patch(outside, a.code.size());
+            a.Patch(notReady, a.code.size());
+            a.MovEaxImm(kBlockDone);
+            a.Ret();
+        };
+        // Turns the address in rax into rdx pointing at its page, or side-exits
+        auto page = [&](A::Reg table) {
+            a.AluRegReg(A::kMov, A::RDX, A::RAX);
+            a.ShrRegImm(A::RDX, kPageShift);
+            a.CmpRegMem(A::RDX, A::RDI, kPageCount);
+            sideExit(A::kAboveOrEqual);
+            a.LoadIndexed(A::RDX, table, A::RDX);
+            a.AluRegReg(A::kTest, A::RDX, A::RDX);
+            sideExit(A::kEqual);
+            a.AndEaxImm(Memory<int64_t>::kPageCells - 1);
+        };
+        // Operand i into dst, straight from the instruction or, if its cell is volatile, from memory
+        auto operand = [&](A::Reg dst, const Instruction<int64_t>& inst, int i) {
+            const int64_t cell = pc + 1 + i;
+            if (!volatile_[cell]) {
+                a.MovRegImm(dst, inst.operands[i]);
+                return;
+            }
+            a.MovRegImm(A::RAX, cell);
+            page(A::R8);
+            a.LoadIndexed(dst, A::RDX, A::RAX);
+        };
+        auto address = [&](const Instruction<int64_t>& inst, int i) {
+            operand(A::RAX, inst, i);
+            if (inst.modes[i] == RELATIVE_MODE) {
+                a.AluRegReg(A::kAdd, A::RAX, A::RCX);
+            }
+        };
+        auto load = [&](A::Reg dst, const Instruction<int64_t>& inst, int i) {
+            if (inst.modes[i] == IMMEDIATE_MODE) {
+                operand(dst, inst, i);
+                return;
+            }
+            address(inst, i);
+            page(A::R8);
+            a.LoadIndexed(dst, A::RDX, A::RAX);
+        };
+        // Checks the destination of a store, leaving rdx pointing at its page and rax at the cell in the page. A
+        // cell in the image is code if its flags say so. Past the image there are no flags, and like RunProgram
+        // anything before decodedEnd counts as code
+        auto destination = [&](const Instruction<int64_t>& inst, int i) {
+            address(inst, i);
+            a.AluRegReg(A::kMov, A::RDX, A::RAX);
+            a.CmpRegMem(A::RDX, A::RDI, kDecodedSize);
+            const size_t pastImage = a.Jcc(A::kAboveOrEqual);
+            a.ImulRegImm(A::RDX, sizeof(Instruction<int64_t>));
+            a.TestByte(A::R11, A::RDX, kFlags, kCodeFlag);
+            const size_t data = a.Jcc(A::kEqual);
+            a.AluRegReg(A::kMov, A::RSI, A::RAX);
+            call(kForget, {A::RAX, A::R10}, kSideExit);
+            a.Patch(data, a.code.size());
+            const size_t checked = a.Jmp();
+            a.Patch(pastImage, a.code.size());
+            a.CmpRegMem(A::RDX, A::RDI, kDecodedEnd);
+            sideExit(A::kLess);
+            a.Patch(checked, a.code.size());
+            page(A::R9);
+        };
+        // Stores r10
+        auto store = [&](const Instruction<int64_t>& inst, int i) {
+            destination(inst, i);
+            a.StoreIndexed(A::RDX, A::RAX, A::R10);
+        };
+
+        a.Load(A::RCX, A::RDI, kRelativeBase);
+        a.Load(A::R8, A::RDI, kReadPages);
+        a.Load(A::R9, A::RDI, kWritePages);
+        a.Load(A::R11, A::RDI, kDecoded);
+
+        int count = 0;
+        bool jumped = false;
+        block.constants.clear();
+        while (count < kMaxBlockInstructions && !volatile_[pc]) {
+            const Instruction<int64_t> inst = DecodeInstruction(memory, pc);
+            if (pc + inst.length > static_cast<int64_t>(memory.ImageSize())) {
+                break;
+            }
+            const bool writes = inst.opcode == ADD || inst.opcode == MULT || inst.opcode == LESS_THAN || inst.opcode == EQUALS;
+            if (writes && inst.modes[2] != IMMEDIATE_MODE) {
+                load(A::R10, inst, 0);
+                load(A::RSI, inst, 1);
+                if (inst.opcode == ADD) {
+                    a.AluRegReg(A::kAdd, A::R10, A::RSI);
+                } else if (inst.opcode == MULT) {
+                    a.ImulRegReg(A::R10, A::RSI);
+                } else {
+                    a.AluRegReg(A::kCmp, A::R10, A::RSI);
+                    a.SetDl(inst.opcode == LESS_THAN ? A::kLess : A::kEqual);
+                    a.MovzxDl(A::R10);
+                }
+                store(inst, 2);
+            } else if (inst.opcode == INPUT && inst.modes[0] != IMMEDIATE_MODE) {
+                // The destination is checked before the sink is asked, so a side exit never loses a value
+                destination(inst, 0);
+                call(kRead, {A::RAX, A::RDX}, kSinkFailed);
+                a.Load(A::R10, A::RDI, kValue);
+                a.StoreIndexed(A::RDX, A::RAX, A::R10);
+            } else if (inst.opcode == OUTPUT) {
+                load(A::R10, inst, 0);
+                a.Store(A::RDI, kValue, A::R10);
+                call(kWrite, {}, kSinkFailed);
+            } else if (inst.opcode == RELATIVE_ADJ) {
+                load(A::R10, inst, 0);
+                a.AluRegReg(A::kAdd, A::RCX, A::R10);
+            } else if (inst.opcode == JUMP_IF_TRUE || inst.opcode == JUMP_IF_FALSE) {
+                load(A::R10, inst, 0);
+                load(A::RSI, inst, 1);
+                a.MovRegImm(A::RAX, pc + inst.length);
+                a.AluRegReg(A::kTest, A::R10, A::R10);
+                a.Cmov(inst.opcode == JUMP_IF_TRUE ? A::kNotEqual : A::kEqual, A::RAX, A::RSI);
+                next();
+                jumped = true;
+            } else {
+                break;
+            }
+            for (int64_t c = pc; c < pc + inst.length; c++) {
+                if (!volatile_[c]) {
+                    block.constants.push_back({c, memory.Load(c)});
+                }
+            }
+            pc += inst.length;
+            count++;
+            if (jumped) {
+                break;
+            }
+        }
+        if (count == 0) {
+            return false;
+        }
+        if (!jumped) {
+            a.MovRegImm(A::RAX, pc);
+            next();
+        }
+
+        // A stub for each way out of each instruction, leaving the VM as it was before that instruction
+        SideExit previous = {0, -1, 0};
+        size_t stub = 0;
+        for (const SideExit& exit : sideExits) {
+            if (exit.pc != previous.pc || exit.status != previous.status) {
+                previous = exit;
+                stub = a.code.size();
+                a.MovRegImm(A::RAX, entry);
+                a.Store(A::RDI, kBlock, A::RAX);
+                a.MovRegImm(A::RAX, exit.pc);
+                leave(exit.status);
+            }
+            a.Patch(exit.rel32, stub);
+        }
+
+        const void* function = code_.Add(a.code);
+        if (!function) {
+            return false;
+        }
+        block.function = reinterpret_cast<BlockFunction>(const_cast<void*>(function));
+        block.end = pc;
+        return true;
+    }
+
+    ExecutableMemory code_;
+    std::vector<Block> blocks_;
+    std::vector<const void*> entries_;
+    std::vector<int64_t> published_; // Where entries_ is set
+    std::vector<bool> volatile_;     // Code cells seen to change since they were compiled
+    uint64_t volatileCells_ = 0;
+    uint64_t version_ = 0;
+    std::vector<const int64_t*> readPages_;
+    std::vector<int64_t*> writePages_;
+    JitContext context_ = {};
+    Intcode<int64_t>* intcode_ = nullptr; // The VM RunBlocks is running, for Forget
+};
+
+// Same contract as RunProgram. Compiled blocks run until one exits to an instruction they can't handle, then the
+// interpreter takes over until it reaches a compiled block again or has to interrupt
+template <typename Input, typename Output>
+Interrupt RunJit(Intcode<int64_t>& intcode, Jit& jit, Input&& input, Output&& output) {
+    JitSinks<std::remove_reference_t<Input>, std::remove_reference_t<Output>> sinks = {&input, &output};
+    while (true) {
+        jit.RunBlocks(intcode, sinks);
+        jit.BreakAfter(intcode);
+        const Interrupt interrupt = RunProgram(intcode, input, output);
+        if (interrupt != kBreak) {
+            return interrupt;
+        }
+    }
+}
+
+template <size_t InCapacity, size_t OutCapacity>
+Interrupt RunJit(Intcode<int64_t>& intcode, Jit& jit, Channel<int64_t, InCapacity>* inputs, Channel<int64_t, OutCapacity>* outputs) {
+    return RunJit(intcode, jit, ChannelInput<int64_t, InCapacity>{inputs}, ChannelOutput<int64_t, OutCapacity>{outputs});
+}
+
+// A null queue falls back to the console, same as RunProgram
+inline Interrupt RunJit(Intcode<int64_t>& intcode, Jit& jit, std::deque<int64_t>* inputs = nullptr, std::deque<int64_t>* outputs = nullptr) {
+    if (inputs && outputs) {
+        return RunJit(intcode, jit, DequeInput<int64_t>{inputs}, DequeOutput<int64_t>{outputs});
+    } else if (inputs) {
+        return RunJit(intcode, jit, DequeInput<int64_t>{inputs}, ConsoleOutput<int64_t>{});
+    } else if (outputs) {
+        return RunJit(intcode, jit, ConsoleInput<int64_t>{}, DequeOutput<int64_t>{outputs});
+    }
+    return RunJit(intcode, jit, ConsoleInput<int64_t>{}, ConsoleOutput<int64_t>{});
+}
+
+#endif
@@ -0,0 +1,74 @@
+#pragma once
+
+// Remembers what whole runs of a program wrote. Intcode is deterministic, so a run fed the same inputs always
+// writes the same outputs and a program run again and again on a few distinct inputs, like day 7's amplifiers, only
+// has to be run once for each.
+
+#include "intcode.h"
+
+#include <deque>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+
+// FNV-1a over the image, to find programs quickly in a RunCache
+template <typename Cell>
+uint64_t ProgramHash(const Memory<Cell>& memory) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (Cell cell : memory.Image()) {
+        uint64_t value = static_cast<uint64_t>(static_cast<int64_t>(cell));
+        for (int byte = 0; byte < 8; byte++) {
+            hash = (hash ^ (value & 0xff)) * 0x100000001b3;
+            value >>= 8;
+        }
+    }
+    return hash;
+}
+
+template <typename Cell>
+class RunCache {
+  public:
+    // An id for program to pass to Outputs. A program whose image was added before gets the same id. The hash
+    // only narrows the search, images are compared in full so programs that happen to hash the same stay apart
+    size_t AddProgram(const Intcode<Cell>& program) {
+        std::vector<Cell> image = program.memory.Image();
+        const uint64_t hash = ProgramHash(program.memory);
+        auto [first, last] = byHash_.equal_range(hash);
+        for (auto it = first; it != last; ++it) {
+            if (images_[it->second] == image) {
+                return it->second;
+            }
+        }
+        byHash_.emplace(hash, programs_.size());
+        programs_.push_back(Fork(program));
+        images_.push_back(std::move(image));
+        return programs_.size() - 1;
+    }
+
+    // Everything the program with that id writes when fed inputs, until it halts or wants more
+    const std::vector<Cell>& Outputs(size_t program, const std::vector<Cell>& inputs) {
+        auto [it, added] = runs_.try_emplace({program, inputs});
+        if (added) {
+            Intcode<Cell> intcode = Fork(programs_[program]);
+            std::deque<Cell> queue(inputs.begin(), inputs.end());
+            std::deque<Cell> outputs;
+            RunProgram(intcode, DequeInput<Cell>{&queue}, DequeOutput<Cell>{&outputs});
+            it->second.assign(outputs.begin(), outputs.end());
+        } else {
+            hits_++;
+        }
+        return it->second;
+    }
+
+    size_t Runs() const { return runs_.size(); }
+    size_t Hits() const { return hits_; }
+
+  private:
+    std::vector<Intcode<Cell>> programs_;
+    std::vector<std::vector<Cell>> images_;       // Of programs_, as they were added
+    std::multimap<uint64_t, size_t> byHash_;      // ProgramHash to index in programs_
+    std::map<std::pair<size_t, std::vector<Cell>>, std::vector<Cell>> runs_;
+    size_t hits_ = 0;
+};
@@ -0,0 +1,70 @@
+#include "clue.h"
+#include "intcode.h"
+#include "intcode_jit.h"
+#include "intcode_trace.h"
+#include <chrono>
+#include <iostream>
+
+// Runs the program in a trace recorded with -record on its recorded inputs, with nothing else in the loop, and
+// checks it writes the same outputs. Times the VM on its own, and catches engine changes that alter behaviour
+struct Args {
+    std::string trace;
+    int iterations = 1;
+    bool jit = false; // Compile hot code to x86-64
+};
+
+int main(int argc, char** argv) {
+    clue::CommandLine<Args> cl;
+    cl.Optional(&Args::iterations, "iterations");
+    cl.Optional(&Args::jit, "jit");
+    cl.Positional(&Args::trace, "trace", "Trace written by day11 or day13 -record", clue::kRequired);
+    auto args = cl.ParseArgs(argc, argv);
+#if !INTCODE_JIT
+    if (args->jit) {
+        std::cerr << "-jit needs x86-64 Linux or macOS\n";
+        return 1;
+    }
+#endif
+
+    std::optional<Trace<int64_t>> trace = ReadTrace<int64_t>(args->trace);
+    if (!trace) {
+        return 1;
+    }
+    Intcode<int64_t> program;
+    program.memory = Memory<int64_t>(trace->image);
+
+    Replay<int64_t> replay = {&*trace};
+    Interrupt interrupt = kHalt;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < args->iterations; i++) {
+        Intcode<int64_t> intcode = program;
+        replay = {&*trace};
+        ReplayInput<int64_t> input = {&replay};
+        ReplayOutput<int64_t> output = {&replay};
+#if INTCODE_JIT
+        if (args->jit) {
+            Jit jit;
+            interrupt = RunJit(intcode, jit, input, output);
+            continue;
+        }
+#endif
+        interrupt = RunProgram(intcode, input, output);
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    printf("%zu of %zu inputs, %zu outputs for %zu recorded, %s\n", replay.inputs, trace->inputs.size(),
+        replay.outputs, trace->outputs.size(), interrupt == kHalt ? "halted" : "waiting for input");
+    printf("%.3f ms per run\n", elapsed.count() / args->iterations);
+    if (replay.firstMismatch != Replay<int64_t>::kNoMismatch) {
+        printf("output %zu is %lld", replay.firstMismatch, static_cast<long long>(replay.mismatch));
+        if (replay.firstMismatch < trace->outputs.size()) {
+            printf(", recorded %lld", static_cast<long long>(trace->outputs[replay.firstMismatch]));
+        }
+        printf("\n");
+    }
+    if (!replay.Matches() || interrupt != kHalt) {
+        printf("replay differs from the recording\n");
+        return 1;
+    }
+    printf("replay matches the recording\n");
+}
@@ -0,0 +1,244 @@
+#pragma once
+
+// I/O traces: the program a VM started with and every value it read and wrote, so a run can be repeated without
+// the driver that produced it. Intcode is deterministic, so the inputs in order are all a replay needs and the
+// outputs are what it should get back. The file is "ICTR" and a version byte, then the image, the inputs and the
+// outputs, each a count followed by its values. Everything after the version is a LEB128 varint, with values
+// zigzag encoded so small negative numbers stay small.
+
+#include "input.h"
+#include "intcode.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <cstdint>
+#include <cstring>
+
+constexpr char kTraceMagic[4] = {'I', 'C', 'T', 'R'};
+constexpr uint8_t kTraceVersion = 1;
+
+template <typename Cell>
+struct Trace {
+    std::vector<Cell> image;
+    std::vector<Cell> inputs;
+    std::vector<Cell> outputs;
+};
+
+// Passes values through from input, appending each one it hands out to values when that is set
+template <typename Cell, typename Input>
+struct RecordingInput {
+    Input input;
+    std::vector<Cell>* values;
+    bool operator()(Cell& value) {
+        if (!input(value)) {
+            return false;
+        }
+        if (values) {
+            values->push_back(value);
+        }
+        return true;
+    }
+};
+
+// Passes values through to output, appending each one it accepts to values when that is set
+template <typename Cell, typename Output>
+struct RecordingOutput {
+    Output output;
+    std::vector<Cell>* values;
+    bool operator()(Cell value) {
+        if constexpr (std::is_same_v<decltype(output(value)), bool>) {
+            if (!output(value)) {
+                return false;
+            }
+        } else {
+            output(value);
+        }
+        if (values) {
+            values->push_back(value);
+        }
+        return true;
+    }
+};
+
+// Sinks that record into trace, or just pass through if it's null. The image is the caller's to fill in
+template <typename Cell, size_t Capacity>
+RecordingInput<Cell, ChannelInput<Cell, Capacity>> RecordInputs(Channel<Cell, Capacity>* channel, Trace<Cell>* trace) {
+    return {{channel}, trace ? &trace->inputs : nullptr};
+}
+
+template <typename Cell, size_t Capacity>
+RecordingOutput<Cell, ChannelOutput<Cell, Capacity>> RecordOutputs(Channel<Cell, Capacity>* channel, Trace<Cell>* trace) {
+    return {{channel}, trace ? &trace->outputs : nullptr};
+}
+
+// Where a replay has got to. Runs out of input, so the VM interrupts with kInput, once the recorded inputs are used up
+template <typename Cell>
+struct Replay {
+    static constexpr size_t kNoMismatch = std::numeric_limits<size_t>::max();
+
+    const Trace<Cell>* trace;
+    size_t inputs = 0;
+    size_t outputs = 0;
+    size_t firstMismatch = kNoMismatch; // Index of the first output that isn't the recorded one
+    Cell mismatch = 0;                  // and what the VM wrote there
+
+    // Every input used and exactly the recorded outputs written
+    bool Matches() const {
+        return inputs == trace->inputs.size() && outputs == trace->outputs.size() && firstMismatch == kNoMismatch;
+    }
+};
+
+template <typename Cell>
+struct ReplayInput {
+    Replay<Cell>* replay;
+    bool operator()(Cell& value) {
+        if (replay->inputs == replay->trace->inputs.size()) {
+            return false;
+        }
+        value = replay->trace->inputs[replay->inputs++];
+        return true;
+    }
+};
+
+template <typename Cell>
+struct ReplayOutput {
+    Replay<Cell>* replay;
+    void operator()(Cell value) {
+        const size_t i = replay->outputs++;
+        if (replay->firstMismatch == Replay<Cell>::kNoMismatch &&
+            (i >= replay->trace->outputs.size() || replay->trace->outputs[i] != value)) {
+            replay->firstMismatch = i;
+            replay->mismatch = value;
+        }
+    }
+};
+
+inline void WriteVarint(std::vector<uint8_t>& bytes, uint64_t value) {
+    while (value >= 0x80) {
+        bytes.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    bytes.push_back(static_cast<uint8_t>(value));
+}
+
+// Reads a varint at p, moving p past it. False if it runs off end or past 64 bits
+inline bool ReadVarint(const uint8_t*& p, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        const uint8_t byte = *p++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline uint64_t ZigZag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t UnZigZag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// A signed varint that has to fit in Cell
+template <typename Cell>
+bool ReadCell(const uint8_t*& p, const uint8_t* end, Cell& cell) {
+    uint64_t zigzag;
+    if (!ReadVarint(p, end, zigzag)) {
+        return false;
+    }
+    const int64_t value = UnZigZag(zigzag);
+    if (value < static_cast<int64_t>(std::numeric_limits<Cell>::min()) || value > static_cast<int64_t>(std::numeric_limits<Cell>::max())) {
+        return false;
+    }
+    cell = static_cast<Cell>(value);
+    return true;
+}
+
+// A count, then the values
+template <typename Cell>
+void WriteCells(std::vector<uint8_t>& bytes, const std::vector<Cell>& values) {
+    WriteVarint(bytes, values.size());
+    for (Cell cell : values) {
+        WriteVarint(bytes, ZigZag(static_cast<int64_t>(cell)));
+    }
+}
+
+template <typename Cell>
+bool ReadCells(const uint8_t*& p, const uint8_t* end, std::vector<Cell>& values) {
+    uint64_t count;
+    // Every value takes at least a byte, which bounds count before anything is allocated for it
+    if (!ReadVarint(p, end, count) || count > static_cast<uint64_t>(end - p)) {
+        return false;
+    }
+    values.resize(count);
+    for (Cell& cell : values) {
+        if (!ReadCell(p, end, cell)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Writes bytes to a temporary file next to path and renames it over path, so a crash part way through leaves
+// whatever was there before
+inline bool WriteFileAtomically(const std::string& path, const std::vector<uint8_t>& bytes) {
+    const std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        if (!file.flush()) {
+            std::cerr << "can't write " << temporary << "\n";
+            return false;
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::cerr << "can't replace " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+template <typename Cell>
+bool WriteTrace(const std::string& path, const Trace<Cell>& trace) {
+    std::vector<uint8_t> bytes(std::begin(kTraceMagic), std::end(kTraceMagic));
+    bytes.push_back(kTraceVersion);
+    WriteCells(bytes, trace.image);
+    WriteCells(bytes, trace.inputs);
+    WriteCells(bytes, trace.outputs);
+    return WriteFileAtomically(path, bytes);
+}
+
+template <typename Cell>
+std::optional<Trace<Cell>> ReadTrace(const std::string& path) {
+    std::optional<InputFile> input = LoadInput(path);
+    if (!input) {
+        return {};
+    }
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(input->begin());
+    const uint8_t* end = reinterpret_cast<const uint8_t*>(input->end());
+    if (end - p < 5 || std::memcmp(p, kTraceMagic, sizeof(kTraceMagic)) != 0) {
+        std::cerr << path << " is not an Intcode trace\n";
+        return {};
+    }
+    if (p[4] != kTraceVersion) {
+        std::cerr << path << " is a version " << static_cast<int>(p[4]) << " trace, expected " << static_cast<int>(kTraceVersion) << "\n";
+        return {};
+    }
+    p += 5;
+    Trace<Cell> trace;
+    if (!ReadCells(p, end, trace.image) || !ReadCells(p, end, trace.inputs) || !ReadCells(p, end, trace.outputs) || p != end) {
+        std::cerr << path << " is truncated, corrupt or too wide for this VM\n";
+        return {};
+    }
+    return trace;
+}